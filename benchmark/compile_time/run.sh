@@ -0,0 +1,91 @@
+#!/usr/bin/env bash
+
+# Compile time benchmark of the TinyUnit++ header.
+#
+# Generates FILES test translation units with ASSERTS assertions each, compiles every unit
+# separately and reports compile time, object files size and executable size.
+#
+# Usage: ./run.sh [FILES] [ASSERTS]
+# Environment: CXX - compiler (default: g++), CXXFLAGS - additional compiler flags.
+
+set -e
+
+FILES=${1:-50}
+ASSERTS=${2:-100}
+CXX=${CXX:-g++}
+CXXFLAGS=${CXXFLAGS:-}
+
+SCRIPT_DIR=$(cd "$(dirname "$0")" && pwd)
+SRC_DIR="$SCRIPT_DIR/../../src"
+BUILD_DIR="$SCRIPT_DIR/build"
+
+rm -rf "$BUILD_DIR"
+mkdir -p "$BUILD_DIR/gen"
+
+now() { date +%s.%N; }
+
+for ((f = 0; f < FILES; ++f)); do
+    {
+        echo '#include "tupp.hpp"'
+        echo
+        echo "void bench_test_$f()"
+        echo "{"
+        echo "    int a = $f;"
+        echo "    float b = $f.0f;"
+        echo "    bool c = true;"
+        for ((i = 0; i < ASSERTS; ++i)); do
+            case $((i % 6)) in
+                0) echo "    TUPP_ASSERT(a, $f);" ;;
+                1) echo "    TUPP_N_ASSERT(a, $((f + i)), \"assert $i\");" ;;
+                2) echo "    TUPP_ASSERT_TRUE(c, \"assert\", \" number $i\");" ;;
+                3) echo "    TUPP_ASSERT_FALSE(!c);" ;;
+                4) echo "    TUPP_ASSERT_F(b, $f.0f, \"float assert $i\");" ;;
+                5) echo "    TUPP_MESSAGE(\"message $i\");" ;;
+            esac
+        done
+        echo "}"
+        echo
+        echo "void bench_register_$f()"
+        echo "{"
+        echo "    TUPP_ADD_TEST(bench_test_$f);"
+        echo "}"
+    } > "$BUILD_DIR/gen/test_$f.cpp"
+done
+
+{
+    echo '#include "tupp.hpp"'
+    echo
+    for ((f = 0; f < FILES; ++f)); do
+        echo "void bench_register_$f();"
+    done
+    echo
+    echo "int main(int argc, char* argv[])"
+    echo "{"
+    for ((f = 0; f < FILES; ++f)); do
+        echo "    bench_register_$f();"
+    done
+    echo "    return tupp::run(argc, argv);"
+    echo "}"
+} > "$BUILD_DIR/gen/main.cpp"
+
+"$CXX" -c "$SRC_DIR/tupp.cpp" -o "$BUILD_DIR/tupp.o" -I "$SRC_DIR" -std=c++17 -pthread $CXXFLAGS
+"$CXX" -c "$BUILD_DIR/gen/main.cpp" -o "$BUILD_DIR/main.o" -I "$SRC_DIR" -std=c++17 -pthread $CXXFLAGS
+
+start=$(now)
+for ((f = 0; f < FILES; ++f)); do
+    "$CXX" -c "$BUILD_DIR/gen/test_$f.cpp" -o "$BUILD_DIR/test_$f.o" -I "$SRC_DIR" -std=c++17 -pthread $CXXFLAGS
+done
+finish=$(now)
+
+"$CXX" "$BUILD_DIR"/*.o -o "$BUILD_DIR/bench.exe" -std=c++17 -pthread $CXXFLAGS
+
+objects_size=$(cat "$BUILD_DIR"/test_*.o | wc -c)
+binary_size=$(wc -c < "$BUILD_DIR/bench.exe")
+
+echo "Files: $FILES, asserts per file: $ASSERTS, compiler: $CXX $CXXFLAGS"
+awk -v s="$start" -v f="$finish" -v n="$FILES" \
+    'BEGIN { printf "Compile time: %.3f s total, %.1f ms per file\n", f - s, (f - s) * 1000 / n }'
+echo "Test objects size: $objects_size bytes"
+echo "Executable size: $binary_size bytes"
+
+"$BUILD_DIR/bench.exe" -s 1000
@@ -0,0 +1,8 @@
+#!/usr/bin/env bash
+
+mkdir build
+g++ -c ./runner.cpp -o ./build/runner.o -I ./../../src -std=c++17 -pthread
+g++ -c ./../../src/tupp.cpp -o ./build/tupp.o -I ./../../src -std=c++17 -pthread
+g++ ./build/tupp.o ./build/runner.o -o ./build/runner.exe -std=c++17 -pthread -rdynamic -ldl
+g++ -shared -fPIC ./math_tests.cpp -o ./build/math_tests.so -I ./../../src -std=c++17
+g++ -shared -fPIC ./string_tests.cpp -o ./build/string_tests.so -I ./../../src -std=c++17
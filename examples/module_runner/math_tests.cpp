@@ -0,0 +1,18 @@
+#include "tupp.hpp"
+
+void example_test_sum()
+{
+    TUPP_ASSERT(2 + 2, 4);
+}
+
+void example_test_float()
+{
+    float a = 0.1f + 0.2f;
+    TUPP_ASSERT_F(a, 0.3f);
+}
+
+TUPP_MODULE()
+{
+    TUPP_ADD_TEST(example_test_sum);
+    TUPP_ADD_TEST(example_test_float);
+}
@@ -0,0 +1,7 @@
+#include "tupp.hpp"
+
+// Generic runner: tests are loaded from test modules by the key `--module`.
+int main(int argc, char* argv[])
+{
+    return tupp::run(argc, argv);
+}
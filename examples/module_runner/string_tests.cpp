@@ -0,0 +1,14 @@
+#include "tupp.hpp"
+
+#include <string>
+
+void example_test_concat()
+{
+    const std::string s = std::string("ab") + "cd";
+    TUPP_ASSERT(s, "abcd");
+}
+
+TUPP_MODULE()
+{
+    TUPP_ADD_TEST(example_test_concat);
+}
@@ -8,14 +8,67 @@
  *************************************************************************************************/
 
 #include "tupp.hpp"
+#include "tupp_async.hpp"
 
 #include <iostream>
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
 #include <cmath>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <mutex>
 #include <optional>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
 #include <unordered_map>
 #include <unordered_set>
 #include <exception>
 
+#if defined(__unix__) || defined(__APPLE__)
+#define TUPP_POSIX
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <cerrno>
+#endif
+
+#ifdef __linux__
+#define TUPP_PERF_EVENT
+#define TUPP_PROC_MEMORY
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#endif
+
+#if defined(TUPP_POSIX) && __has_include(<dlfcn.h>)
+#define TUPP_MODULES
+#include <dlfcn.h>
+#endif
+
+#if defined(TUPP_MODULES) && __has_include(<execinfo.h>)
+#define TUPP_PROFILER
+#include <cxxabi.h>
+#include <execinfo.h>
+#include <sys/time.h>
+#endif
+
 const std::string PROG_NAME = "TinyUnit++";
 const unsigned int PROG_VER_MAJ = 0u;
 const unsigned int PROG_VER_MIN = 2u;
@@ -23,23 +76,180 @@ const unsigned int PROG_VER_COR = 0u;
 const std::string PROG_COPYRIGHT = "Copyright (c) 2024: Konovalov Aleksander, BSD-2-Clause license.";
 const std::string PROG_URL = "https://github.com/kasandko/tinyunitpp";
 
+/// @brief Parameters of the current assert or message.
+///
+/// Texts are not copied: they are valid until the end of the assert or message method call. Only
+/// `msg` of the assert macros (`static_msg`) is valid until the end of the program.
 struct case_params
 {
     case_params() = default;
 
     std::optional<size_t> line;
-    std::string msg;
-    std::string additional_msg;
-    std::string expected;
+    std::string_view msg;
+    bool static_msg = false;
+    tupp::MsgList additionals;
+    std::string_view expected;
     std::optional<bool> assert_result;
 
     bool has_msg() const { return !msg.empty(); }
-    bool has_additional() const { return !additional_msg.empty(); }
+    bool has_additional() const
+    {
+        return std::any_of(additionals.begin(), additionals.end(), [](std::string_view s) { return !s.empty(); });
+    }
     bool has_expected() const { return !expected.empty(); }
     bool has_result() const { return assert_result.has_value(); }
     bool get_result() const { return assert_result.value_or(false); }
 };
 
+static std::string join_additionals(tupp::MsgList additionals)
+{
+    std::string result;
+    for (const std::string_view & additional : additionals)
+        result += additional;
+    return result;
+}
+
+/// @brief Storage of texts of the test messages and fails.
+///
+/// Texts are placed one after another in big blocks. `reset()` doesn't free blocks, so after the
+/// first tests the storage works without allocations.
+class text_arena
+{
+public:
+
+    text_arena() = default;
+    text_arena(text_arena &&) = default;
+    text_arena & operator=(text_arena &&) = default;
+
+    std::string_view store(std::string_view text)
+    {
+        return store({text});
+    }
+
+    std::string_view store(tupp::MsgList parts)
+    {
+        size_t size = 0u;
+        for (const std::string_view & part : parts)
+            size += part.size();
+        if (size == 0u)
+            return {};
+
+        char * data = allocate(size);
+        char * pos = data;
+        for (const std::string_view & part : parts)
+        {
+            std::memcpy(pos, part.data(), part.size());
+            pos += part.size();
+        }
+        return std::string_view(data, size);
+    }
+
+    void reset()
+    {
+        _block = 0u;
+        _used = 0u;
+    }
+
+private:
+
+    static constexpr size_t BLOCK_SIZE = 16u * 1024u;
+
+    struct block
+    {
+        std::unique_ptr<char[]> data;
+        size_t size;
+    };
+
+    char * allocate(size_t size)
+    {
+        while (_block < _blocks.size() && _used + size > _blocks[_block].size)
+        {
+            ++_block;
+            _used = 0u;
+        }
+
+        if (_block == _blocks.size())
+        {
+            const size_t block_size = std::max(size, BLOCK_SIZE);
+            _blocks.push_back(block{std::make_unique<char[]>(block_size), block_size});
+            _used = 0u;
+        }
+
+        char * data = _blocks[_block].data.get() + _used;
+        _used += size;
+        return data;
+    }
+
+    std::vector<block> _blocks;
+    size_t _block = 0u;
+    size_t _used = 0u;
+};
+
+/// @brief Compact record of a test message or fail. Text is formatted only for displaying.
+struct case_record
+{
+    enum class record_type
+    {
+        MESSAGE,
+        FAIL,
+        TEXT,
+    };
+
+    record_type type;
+    std::optional<size_t> line;
+    std::string_view msg;
+    std::string_view expected;
+    std::string_view additional_msg;
+
+    std::string format() const;
+};
+
+std::string case_record::format() const
+{
+    std::string result;
+    switch (type)
+    {
+    case record_type::MESSAGE:
+        result = "Message: ";
+        result += msg;
+        if (!msg.empty() && !additional_msg.empty())
+            result += " ";
+        result += additional_msg;
+        break;
+
+    case record_type::FAIL:
+        result = "Fail";
+        if (!msg.empty())
+        {
+            result += " ";
+            result += msg;
+        }
+        if (!expected.empty())
+        {
+            result += " (expected: ";
+            result += expected;
+            result += ")";
+        }
+        if (!additional_msg.empty())
+        {
+            result += ": ";
+            result += additional_msg;
+        }
+        break;
+
+    case record_type::TEXT:
+    default:
+        result = msg;
+        break;
+    }
+
+    // The line number of a multiline message is placed at the end of the first line.
+    if (line)
+        result.insert(std::min(result.find('\n'), result.size()), " Line: " + std::to_string(*line));
+
+    return result;
+}
+
 struct status
 {
     enum class status_code
@@ -52,7 +262,10 @@ struct status
         BAD_CMD,
         RUN_HELP,
         RUN_VERSION,
+        RUN_LIST,
         RUN_TEST,
+        MODULE_ERROR,
+        OUTPUT_ERROR,
     };
 
     status() = delete;
@@ -77,216 +290,1499 @@ public:
     tupp_exception() = default;
 };
 
-class tupp_internal
+/// @brief Writer of the machine-readable events stream (one JSON object per line).
+///
+/// Events are accumulated in a buffer and written by batches. On POSIX systems the output
+/// descriptor is switched to the non-blocking mode, so a slow consumer doesn't stop tests: the
+/// not written data stay in the buffer until the next flush. If the consumer is stalled, the next
+/// write is tried only after one more batch, and events which don't fit the buffer limit are
+/// dropped and counted. The buffer is drained completely on destruction.
+class event_writer
 {
 public:
 
-    tupp_internal() = default;
+    event_writer() = default;
+    event_writer(const event_writer &) = delete;
+    event_writer & operator=(const event_writer &) = delete;
+    ~event_writer();
+
+    /// @brief Open the stream to the inherited file descriptor `fd` (POSIX only).
+    ///
+    /// Flags of the inherited descriptor are shared with other descriptors of the same file (for
+    /// example stdout) and with other processes, so they are not changed. A pipe is reopened by
+    /// `/proc/self/fd` to get own non-blocking descriptor, a socket is written by non-blocking
+    /// `send()`. Other descriptors (and pipes which can't be reopened) are written in the blocking
+    /// mode.
+    bool open_fd(int fd);
+    /// @brief Open the stream to the file `path`.
+    bool open_file(const std::string & path);
+    void write(const std::string & event);
+    void flush(bool wait);
+
+    size_t dropped() const { return _dropped; }
 
-    void set_line(size_t line);
-    void set_msg(const std::string & msg);
-    void set_additional_msg(const std::string & additional_msg);
-    void set_expected(const std::string & expected);
-    void assert(bool v);
-    void apply_case();
-    int run(int argc, char* argv[]);
+private:
 
-    void add_test(const std::function<void()> & func, const std::string & name);
+    static constexpr size_t BATCH_SIZE = 64u * 1024u;
+    static constexpr size_t MAX_BUFFER_SIZE = 256u * BATCH_SIZE;
+
+    size_t pending() const { return _buffer.size() - _offset; }
+
+#ifdef TUPP_POSIX
+    void ignore_sigpipe();
+
+    int _fd = -1;
+    bool _socket = false;
+    // SIGPIPE is ignored while the stream is open, so a closed consumer only gives EPIPE.
+    bool _sigpipe_saved = false;
+    struct sigaction _old_sigpipe = {};
+#else
+    std::FILE * _file = nullptr;
+#endif
+    std::string _buffer;
+    // Offset of the not written data in the buffer.
+    size_t _offset = 0u;
+    // Size of the not written data which allows the next write after the consumer was stalled.
+    size_t _retry_size = 0u;
+    size_t _dropped = 0u;
+};
 
-    void clear_case_params()
+event_writer::~event_writer()
+{
+    flush(true);
+#ifdef TUPP_POSIX
+    if (_fd >= 0)
+        ::close(_fd);
+    if (_sigpipe_saved)
+        ::sigaction(SIGPIPE, &_old_sigpipe, nullptr);
+#else
+    if (_file)
+        std::fclose(_file);
+#endif
+}
+
+bool event_writer::open_fd(int fd)
+{
+#ifdef TUPP_POSIX
+    struct stat st;
+    if (fd < 0 || ::fstat(fd, &st) != 0)
+        return false;
+
+    int type = 0;
+    socklen_t type_size = sizeof(type);
+    _socket = S_ISSOCK(st.st_mode) && ::getsockopt(fd, SOL_SOCKET, SO_TYPE, &type, &type_size) == 0;
+
+    // Reopening of a regular file would start writing from its beginning, so only pipes are
+    // reopened.
+    if (S_ISFIFO(st.st_mode))
+        _fd = ::open(("/proc/self/fd/" + std::to_string(fd)).c_str(), O_WRONLY | O_NONBLOCK | O_CLOEXEC);
+    if (_fd < 0)
+        _fd = ::fcntl(fd, F_DUPFD_CLOEXEC, 0);
+    if (_fd < 0)
+        return false;
+
+    ignore_sigpipe();
+    return true;
+#else
+    (void)fd;
+    return false;
+#endif
+}
+
+bool event_writer::open_file(const std::string & path)
+{
+    if (path.empty())
+        return false;
+
+#ifdef TUPP_POSIX
+    _fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (_fd < 0)
+        return false;
+
+    // The descriptor is own, so its flags can be changed (it matters for named pipes).
+    ::fcntl(_fd, F_SETFL, ::fcntl(_fd, F_GETFL) | O_NONBLOCK);
+    ignore_sigpipe();
+    return true;
+#else
+    _file = std::fopen(path.c_str(), "wb");
+    return _file != nullptr;
+#endif
+}
+
+#ifdef TUPP_POSIX
+void event_writer::ignore_sigpipe()
+{
+    struct sigaction action = {};
+    action.sa_handler = SIG_IGN;
+    sigemptyset(&action.sa_mask);
+    _sigpipe_saved = ::sigaction(SIGPIPE, &action, &_old_sigpipe) == 0;
+}
+#endif
+
+void event_writer::write(const std::string & event)
+{
+    if (pending() + event.size() + 1u > MAX_BUFFER_SIZE)
     {
-        _case_params = std::nullopt;
+        ++_dropped;
+        return;
     }
 
-private:
+    _buffer += event;
+    _buffer += '\n';
+    if (pending() >= std::max(BATCH_SIZE, _retry_size))
+        flush(false);
+}
 
-    enum class message_type
-    {
-        DEFAULT,
-        TEST_NAME,
-        TEST_MESSAGE,
-        HEADER,
-        FAIL,
-        SUCCESS,
-        REPORT,
-    };
+void event_writer::flush(bool wait)
+{
+#ifdef TUPP_POSIX
+    if (_fd < 0 || (!wait && pending() < _retry_size))
+        return;
 
-    void init_case_params();
-    status parse_cmd(int argc, char* argv[]);
-    static std::string parse_cmd_key(const std::string & arg);
-    status apply_cmd_params();
-    int handle_status(const status & st);
-    void print(message_type type, const std::string & message, bool cr) const;
-    static std::string make_tab(size_t tabs_count);
+#ifdef MSG_NOSIGNAL
+    static constexpr int SEND_FLAGS = MSG_DONTWAIT | MSG_NOSIGNAL;
+#else
+    static constexpr int SEND_FLAGS = MSG_DONTWAIT;
+#endif
 
-    static void show_help();
-    static void show_version();
-    static void show_error(const std::string & error_msg);
-    int run_tests();
+    _retry_size = 0u;
+    while (_offset < _buffer.size())
+    {
+        const ssize_t res = _socket
+            ? ::send(_fd, _buffer.data() + _offset, _buffer.size() - _offset, SEND_FLAGS)
+            : ::write(_fd, _buffer.data() + _offset, _buffer.size() - _offset);
+        if (res > 0)
+        {
+            _offset += static_cast<size_t>(res);
+            continue;
+        }
 
-private:
+        if (res < 0 && errno == EINTR)
+            continue;
 
-    std::optional<case_params> _case_params;
-    std::vector<std::string> _case_messages;
-    bool _case_result = true;
+        if (res < 0 && (errno == EAGAIN || errno == EWOULDBLOCK) && wait)
+        {
+            pollfd pfd = {_fd, POLLOUT, 0};
+            ::poll(&pfd, 1, -1);
+            continue;
+        }
 
-    std::unordered_map<std::string, std::vector<std::string>> _cmd_params;
-    std::unordered_set<std::string> _tests_to_run;
-    std::unordered_map<std::string, std::function<void()>> _all_tests;
+        if (res < 0 && errno != EAGAIN && errno != EWOULDBLOCK)
+            _offset = _buffer.size(); // The consumer is gone. Drop events.
+        else
+            _retry_size = pending() + BATCH_SIZE; // The consumer is stalled.
+        break;
+    }
 
-    struct
+    // The written data are removed only when they are at least a half of the buffer, so every
+    // byte is moved no more than once on average.
+    if (_offset == _buffer.size())
     {
-        bool hide_all_messages = false;
-        bool hide_header = false;
-        bool hide_report = false;
-        bool hide_test_messages = false;
-        bool hide_test_names = false;
-        bool continue_after_assert = false;
-    } _config;
-};
+        _buffer.clear();
+        _offset = 0u;
+    }
+    else if (_offset >= _buffer.size() / 2u)
+    {
+        _buffer.erase(0u, _offset);
+        _offset = 0u;
+    }
+#else
+    if (!_file)
+        return;
 
+    std::fwrite(_buffer.data(), 1u, _buffer.size(), _file);
+    std::fflush(_file);
+    _buffer.clear();
+#endif
+}
 
-void tupp_internal::set_line(size_t line)
+/// @brief Tracker of the process resident memory during a test execution.
+///
+/// A background thread samples `/proc/self/statm` and stores the peak value. The kernel high water
+/// mark (`VmHWM`) is reset before a test by `/proc/self/clear_refs` and is used for correction of
+/// the peak after the test, so short peaks between samples are not lost. Works on Linux only.
+///
+/// The tracker only measures memory. Tests with a memory limit are run in a child process which
+/// is killed by the runner when its memory exceeds the limit.
+class memory_tracker
 {
-    init_case_params();
-    _case_params->line = line;
-}
+public:
+
+    static constexpr std::chrono::milliseconds SAMPLE_PERIOD{2};
+
+    memory_tracker() = default;
+    memory_tracker(const memory_tracker &) = delete;
+    memory_tracker & operator=(const memory_tracker &) = delete;
+    ~memory_tracker() { stop(); }
+
+    static bool available();
+    /// @brief Resident memory of the process `pid` (0 - this process) in kilobytes.
+    static size_t current_rss_kb(int pid = 0);
+
+    void start();
+    /// @brief Stop tracking. Returns the peak resident memory in kilobytes.
+    size_t stop();
+
+private:
+
+    void sample();
+    static size_t peak_rss_kb();
+    static bool reset_peak();
+
+    std::thread _thread;
+    std::mutex _mutex;
+    std::condition_variable _cv;
+    bool _stop = false;
+    bool _peak_reset = false;
+    std::atomic<size_t> _peak_kb{0u};
+};
 
-void tupp_internal::set_msg(const std::string & msg)
+bool memory_tracker::available()
 {
-    init_case_params();
-    _case_params->msg = msg;
+#ifdef TUPP_PROC_MEMORY
+    return current_rss_kb() > 0u;
+#else
+    return false;
+#endif
 }
 
-void tupp_internal::set_additional_msg(const std::string & additional_msg)
+void memory_tracker::start()
 {
-    init_case_params();
-    _case_params->additional_msg = additional_msg;
+    stop();
+
+    _stop = false;
+    _peak_reset = reset_peak();
+    _peak_kb = current_rss_kb();
+
+#ifdef TUPP_POSIX
+    // The thread inherits the signal mask: it must not get samples of the profiler.
+    sigset_t profiler_signal;
+    sigset_t old_mask;
+    sigemptyset(&profiler_signal);
+    sigaddset(&profiler_signal, SIGPROF);
+    ::pthread_sigmask(SIG_BLOCK, &profiler_signal, &old_mask);
+#endif
+    _thread = std::thread([this]()
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        while (!_cv.wait_for(lock, SAMPLE_PERIOD, [this]() { return _stop; }))
+            sample();
+    });
+#ifdef TUPP_POSIX
+    ::pthread_sigmask(SIG_SETMASK, &old_mask, nullptr);
+#endif
 }
 
-void tupp_internal::set_expected(const std::string & expected)
+size_t memory_tracker::stop()
 {
-    init_case_params();
-    _case_params->expected = expected;
+    if (!_thread.joinable())
+        return _peak_kb;
+
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stop = true;
+    }
+    _cv.notify_one();
+    _thread.join();
+
+    sample();
+    if (_peak_reset)
+        _peak_kb = std::max<size_t>(_peak_kb, peak_rss_kb());
+    return _peak_kb;
 }
 
-void tupp_internal::assert(bool v)
+void memory_tracker::sample()
 {
-    _case_params->assert_result = v;
+    const size_t rss_kb = current_rss_kb();
+    if (rss_kb > _peak_kb)
+        _peak_kb = rss_kb;
 }
 
-void tupp_internal::apply_case()
+size_t memory_tracker::current_rss_kb(int pid)
 {
-    if (!_case_params)
-        return;
+#ifdef TUPP_PROC_MEMORY
+    const std::string path = "/proc/" + (pid > 0 ? std::to_string(pid) : std::string("self")) + "/statm";
+    std::FILE * file = std::fopen(path.c_str(), "r");
+    if (!file)
+        return 0u;
+
+    unsigned long long size = 0u;
+    unsigned long long resident = 0u;
+    const int res = std::fscanf(file, "%llu %llu", &size, &resident);
+    std::fclose(file);
+    if (res != 2)
+        return 0u;
+
+    static const long page_size = ::sysconf(_SC_PAGESIZE);
+    return static_cast<size_t>(resident * static_cast<unsigned long long>(page_size) / 1024u);
+#else
+    (void)pid;
+    return 0u;
+#endif
+}
 
-    struct cleaner
+size_t memory_tracker::peak_rss_kb()
+{
+#ifdef TUPP_PROC_MEMORY
+    std::ifstream file("/proc/self/status");
+    std::string line;
+    while (std::getline(file, line))
     {
-        tupp_internal * internal;
-        explicit cleaner(tupp_internal * internal) : internal(internal) {}
-        ~cleaner() { internal->clear_case_params(); }
-    } obj_cleaner(this);
+        if (line.compare(0u, 6u, "VmHWM:") == 0)
+            return static_cast<size_t>(std::strtoull(line.c_str() + 6u, nullptr, 10));
+    }
+#endif
+    return 0u;
+}
 
-    std::string msg;
-    if (!_case_params->has_result())
-    {
-        if (_case_params->has_msg())
-            msg += _case_params->msg;
+bool memory_tracker::reset_peak()
+{
+#ifdef TUPP_PROC_MEMORY
+    std::FILE * file = std::fopen("/proc/self/clear_refs", "w");
+    if (!file)
+        return false;
+
+    const bool res = std::fputs("5", file) >= 0;
+    return std::fclose(file) == 0 && res;
+#else
+    return false;
+#endif
+}
 
-        if (_case_params->has_additional())
-        {
-            if (!msg.empty())
-                msg += " ";
-            msg += _case_params->additional_msg;
-        }
+/// @brief Sampling profiler of a test execution.
+///
+/// `setitimer(ITIMER_PROF)` sends `SIGPROF` every `SAMPLE_PERIOD` of the process CPU time. The
+/// signal handler only captures the stack by `backtrace()` to a preallocated buffer. After a test
+/// stacks are symbolized by `dladdr()` and written as collapsed stacks (`root;...;leaf count` per
+/// line) which are accepted by flame graph tools. Works on POSIX systems with `<execinfo.h>` only.
+///
+/// The handler is installed once and is never removed: a signal which is sent before the timer is
+/// stopped can be handled later, and the default action would finish the process. Without an
+/// enabled profiler the handler does nothing. Threads of the runner block `SIGPROF`, so only the
+/// test threads are sampled.
+class sampling_profiler
+{
+public:
 
-        if (msg.empty())
-            return;
+    sampling_profiler();
+    sampling_profiler(const sampling_profiler &) = delete;
+    sampling_profiler & operator=(const sampling_profiler &) = delete;
+    ~sampling_profiler();
 
-        msg = "Message: " + msg;
-    }
-    else
-    {
-        if (_case_params->get_result())
-            return;
+    static bool available();
 
-        _case_result = false;
+    void start();
+    /// @brief Stop sampling.
+    void stop();
+    /// @brief Write collapsed stacks of the last sampling to the file `path`.
+    bool write(const std::string & path);
 
-        msg = "Fail";
-        if (_case_params->has_msg())
-            msg += " " + _case_params->msg;
+    size_t samples() const { return std::min(_next.load(), MAX_SAMPLES); }
+    size_t dropped() const { return _next.load() - samples(); }
 
-        if (_case_params->has_expected())
-            msg += " (expected: " + _case_params->expected + ")";
+private:
 
-        if (_case_params->has_additional())
-            msg += ": " + _case_params->additional_msg;
-    }
+    static constexpr size_t MAX_DEPTH = 64u;
+    static constexpr size_t MAX_SAMPLES = 32768u;
+    static constexpr long SAMPLE_PERIOD_US = 1000;
+    // Frames of the signal handler and the signal trampoline.
+    static constexpr size_t SKIPPED_FRAMES = 2u;
+
+    static void handle_signal(int);
+    std::string symbol(void * address, bool return_address);
+
+    static std::atomic<sampling_profiler *> _instance;
+    // Count of the working signal handlers.
+    static std::atomic<int> _active;
+
+    std::unique_ptr<void * []> _frames;
+    std::unique_ptr<int []> _depths;
+    std::atomic<size_t> _next{0u};
+    std::atomic<bool> _enabled{false};
+    bool _running = false;
+    // Stack of the runner which is cut from samples of the test thread.
+    std::vector<void *> _base;
+    std::unordered_map<void *, std::string> _symbols;
+};
 
-    if (_case_params->line)
-        msg += " Line: " + std::to_string(*_case_params->line);
+std::atomic<sampling_profiler *> sampling_profiler::_instance{nullptr};
+std::atomic<int> sampling_profiler::_active{0};
 
-    _case_messages.push_back(msg);
+sampling_profiler::sampling_profiler()
+    // Pages of the buffers are allocated by the system only when samples are written.
+    : _frames(new void * [MAX_SAMPLES * MAX_DEPTH]), _depths(new int [MAX_SAMPLES])
+{
+#ifdef TUPP_PROFILER
+    _instance = this;
+
+    struct sigaction action = {};
+    action.sa_handler = &sampling_profiler::handle_signal;
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    ::sigaction(SIGPROF, &action, nullptr);
+#endif
+}
 
-    if (_case_params->has_result() && !_config.continue_after_assert)
-        throw tupp_exception();
+sampling_profiler::~sampling_profiler()
+{
+    stop();
+    _instance = nullptr;
+    while (_active.load() > 0)
+        std::this_thread::yield();
 }
 
-int tupp_internal::run(int argc, char* argv[])
+bool sampling_profiler::available()
 {
-    status st = parse_cmd(argc, argv);
-    if (st.code != status::status_code::SUCCESS)
-        return handle_status(st);
+#ifdef TUPP_PROFILER
+    return true;
+#else
+    return false;
+#endif
+}
 
-    st = apply_cmd_params();
-    return handle_status(st);
+void sampling_profiler::start()
+{
+#ifdef TUPP_PROFILER
+    stop();
+
+    // The first call of `backtrace()` loads the unwinder, it can't be done in the signal handler.
+    _base.resize(MAX_DEPTH);
+    _base.resize(static_cast<size_t>(::backtrace(_base.data(), static_cast<int>(MAX_DEPTH))));
+
+    _next = 0u;
+    _enabled = true;
+
+    struct itimerval timer = {};
+    timer.it_interval.tv_usec = SAMPLE_PERIOD_US;
+    timer.it_value.tv_usec = SAMPLE_PERIOD_US;
+    ::setitimer(ITIMER_PROF, &timer, nullptr);
+    _running = true;
+#endif
 }
 
-void tupp_internal::add_test(const std::function<void()> & func, const std::string & name)
+void sampling_profiler::stop()
 {
-    _all_tests.emplace(name, func);
+#ifdef TUPP_PROFILER
+    if (!_running)
+        return;
+
+    struct itimerval timer = {};
+    ::setitimer(ITIMER_PROF, &timer, nullptr);
+    // Handlers of already sent signals can still work in other threads.
+    _enabled = false;
+    while (_active.load() > 0)
+        std::this_thread::yield();
+    _running = false;
+#endif
 }
 
-void tupp_internal::init_case_params()
+void sampling_profiler::handle_signal(int)
 {
-    if (!_case_params)
-        _case_params = case_params();
+#ifdef TUPP_PROFILER
+    const int saved_errno = errno;
+    ++_active;
+    sampling_profiler * profiler = _instance.load();
+    if (profiler && profiler->_enabled)
+    {
+        const size_t slot = profiler->_next++;
+        if (slot < MAX_SAMPLES)
+            profiler->_depths[slot] = ::backtrace(profiler->_frames.get() + slot * MAX_DEPTH, static_cast<int>(MAX_DEPTH));
+    }
+    --_active;
+    errno = saved_errno;
+#endif
 }
 
-status tupp_internal::parse_cmd(int argc, char* argv[])
+std::string sampling_profiler::symbol(void * address, bool return_address)
 {
-    std::string key;
-    for (int i = 1 /* Skip exe file. */; i < argc; ++i)
+    auto it = _symbols.find(address);
+    if (it != _symbols.end())
+        return it->second;
+
+    char buffer[32];
+    std::snprintf(buffer, sizeof(buffer), "%p", address);
+    std::string name = buffer;
+#ifdef TUPP_PROFILER
+    // A return address can point to the next function, so the call instruction is looked up.
+    Dl_info info;
+    if (::dladdr(static_cast<char *>(address) - (return_address ? 1 : 0), &info) != 0)
     {
-        std::string s_argv(argv[i]);
-        if (const std::string new_key = parse_cmd_key(s_argv); !new_key.empty())
+        if (info.dli_sname)
         {
-            if (!key.empty())
-                _cmd_params.emplace(key, std::vector<std::string>());
-            key = new_key;
+            int status = 0;
+            char * demangled = abi::__cxa_demangle(info.dli_sname, nullptr, nullptr, &status);
+            name = status == 0 && demangled ? demangled : info.dli_sname;
+            std::free(demangled);
         }
-        else
+        else if (info.dli_fname)
         {
-            if (key.empty())
-                return {status::status_code::BAD_CMD, "Invalid key: '" + s_argv + "'"};
-
-            auto it = _cmd_params.find(key);
-            if (it == _cmd_params.end())
-                it = _cmd_params.emplace(key, std::vector<std::string>()).first;
-            it->second.push_back(s_argv);
+            const std::string module = std::filesystem::path(info.dli_fname).filename().string();
+            std::snprintf(buffer, sizeof(buffer), "+0x%llx", static_cast<unsigned long long>(
+                static_cast<char *>(address) - static_cast<char *>(info.dli_fbase)));
+            name = module + buffer;
         }
     }
+#else
+    (void)return_address;
+#endif
+    std::replace(name.begin(), name.end(), ';', ':');
+    return _symbols.emplace(address, std::move(name)).first->second;
+}
 
-    if (!key.empty())
-        _cmd_params.emplace(key, std::vector<std::string>());
+bool sampling_profiler::write(const std::string & path)
+{
+    std::map<std::vector<void *>, unsigned long long> stacks;
+    for (size_t i = 0u; i < samples(); ++i)
+    {
+        void ** frames = _frames.get() + i * MAX_DEPTH;
+        size_t depth = static_cast<size_t>(_depths[i]);
+        if (depth <= SKIPPED_FRAMES)
+            continue;
+
+        // Callers of the test function are the same as callers of `start()` (except the runner
+        // function itself which calls them from different places). They are cut.
+        size_t common = 0u;
+        while (common < depth && common < _base.size() && frames[depth - common - 1u] == _base[_base.size() - common - 1u])
+            ++common;
+        if (common > 0u)
+            depth -= std::min(depth, common + 1u);
+
+        if (depth > SKIPPED_FRAMES)
+            ++stacks[std::vector<void *>(frames + SKIPPED_FRAMES, frames + depth)];
+    }
 
-    return {status::status_code::SUCCESS};
+    // Different addresses of the same functions give the same collapsed stack.
+    std::map<std::string, unsigned long long> collapsed;
+    for (const auto & [frames, count] : stacks)
+    {
+        std::string line;
+        for (size_t i = frames.size(); i-- > 0u;)
+        {
+            line += symbol(frames[i], i > 0u);
+            if (i > 0u)
+                line += ';';
+        }
+        collapsed[line] += count;
+    }
+
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    for (const auto & [line, count] : collapsed)
+        file << line << ' ' << count << '\n';
+    file.close();
+    return static_cast<bool>(file);
 }
 
-std::string tupp_internal::parse_cmd_key(const std::string & arg)
+/// @brief Helper for build one JSON object (line of the events stream or the manifest).
+class json_builder
 {
-    if (arg.empty())
-        return {};
+public:
+
+    json_builder() { _json.reserve(128u); }
+
+    json_builder & add(const char * key, std::string_view value)
+    {
+        add_key(key);
+        add_string(value);
+        return *this;
+    }
+
+    json_builder & add(const char * key, unsigned long long value)
+    {
+        add_key(key);
+        _json += std::to_string(value);
+        return *this;
+    }
+
+    json_builder & add(const char * key, const std::vector<std::string> & values)
+    {
+        add_key(key);
+        _json += '[';
+        for (size_t i = 0u; i < values.size(); ++i)
+        {
+            if (i > 0u)
+                _json += ',';
+            add_string(values[i]);
+        }
+        _json += ']';
+        return *this;
+    }
+
+    std::string str() const { return "{" + _json + "}"; }
+
+    void append_to(std::string & out) const
+    {
+        out += '{';
+        out += _json;
+        out += '}';
+    }
+
+private:
+
+    void add_key(const char * key)
+    {
+        if (!_json.empty())
+            _json += ',';
+        _json += '"';
+        _json += key;
+        _json += "\":";
+    }
+
+    void add_string(std::string_view value)
+    {
+        _json += '"';
+        if (value.find_first_of("\"\\\n\r\t") == std::string_view::npos
+            && std::none_of(value.begin(), value.end(), [](char c) { return static_cast<unsigned char>(c) < 0x20u; }))
+        {
+            _json += value;
+            _json += '"';
+            return;
+        }
+
+        for (const char c : value)
+        {
+            switch (c)
+            {
+            case '"': _json += "\\\""; break;
+            case '\\': _json += "\\\\"; break;
+            case '\n': _json += "\\n"; break;
+            case '\r': _json += "\\r"; break;
+            case '\t': _json += "\\t"; break;
+            default:
+                if (static_cast<unsigned char>(c) < 0x20u)
+                {
+                    char code[8];
+                    std::snprintf(code, sizeof(code), "\\u%04x", static_cast<unsigned int>(c));
+                    _json += code;
+                }
+                else
+                {
+                    _json += c;
+                }
+                break;
+            }
+        }
+        _json += '"';
+    }
+
+    std::string _json;
+};
+
+/// @brief Helper for build one event of the events stream.
+class event_builder : public json_builder
+{
+public:
+
+    explicit event_builder(const char * type)
+    {
+        add("event", type);
+    }
+};
+
+/// @brief Read-only file mapped to the memory.
+///
+/// On POSIX systems the file is mapped by `mmap`, so its content is not copied and big files are
+/// processed with constant memory. On other systems the file is read to the memory.
+class mapped_file
+{
+public:
+
+    mapped_file() = default;
+    mapped_file(const mapped_file &) = delete;
+    mapped_file & operator=(const mapped_file &) = delete;
+    ~mapped_file();
+
+    bool open(const std::string & path);
+    std::string_view data() const;
+    /// @brief Drop the already read pages before `offset` from memory, they are read again on access.
+    void release(size_t offset);
+
+private:
+
+#ifdef TUPP_POSIX
+    void * _data = nullptr;
+    size_t _size = 0u;
+#else
+    std::string _data;
+#endif
+};
+
+mapped_file::~mapped_file()
+{
+#ifdef TUPP_POSIX
+    if (_data)
+        ::munmap(_data, _size);
+#endif
+}
+
+bool mapped_file::open(const std::string & path)
+{
+#ifdef TUPP_POSIX
+    const int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+
+    struct stat st;
+    if (::fstat(fd, &st) != 0 || !S_ISREG(st.st_mode))
+    {
+        ::close(fd);
+        return false;
+    }
+
+    _size = static_cast<size_t>(st.st_size);
+    if (_size > 0u)
+    {
+        _data = ::mmap(nullptr, _size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (_data == MAP_FAILED)
+            _data = nullptr;
+        else
+            ::madvise(_data, _size, MADV_SEQUENTIAL);
+    }
+    ::close(fd);
+    return _size == 0u || _data != nullptr;
+#else
+    std::ifstream file(path, std::ios::binary);
+    if (!file)
+        return false;
+    _data.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    return true;
+#endif
+}
+
+std::string_view mapped_file::data() const
+{
+#ifdef TUPP_POSIX
+    return _data ? std::string_view(static_cast<const char *>(_data), _size) : std::string_view();
+#else
+    return _data;
+#endif
+}
+
+void mapped_file::release(size_t offset)
+{
+#ifdef TUPP_POSIX
+    static const size_t page_size = static_cast<size_t>(::sysconf(_SC_PAGESIZE));
+
+    const size_t size = std::min(offset, _size) / page_size * page_size;
+    if (_data && size > 0u)
+        ::madvise(_data, size, MADV_DONTNEED);
+#else
+    (void)offset;
+#endif
+}
+
+/// @brief Find the offset of the first difference of `a` and `b`.
+///
+/// The compared pages of the mapped files are released, so the used memory doesn't depend on
+/// the size of the files.
+static size_t find_mismatch(std::string_view a, std::string_view b, mapped_file & a_file, mapped_file & b_file)
+{
+    static constexpr size_t CHUNK_SIZE = 1024u * 1024u;
+
+    const size_t size = std::min(a.size(), b.size());
+    size_t offset = 0u;
+    while (offset < size)
+    {
+        const size_t chunk = std::min(CHUNK_SIZE, size - offset);
+        if (std::memcmp(a.data() + offset, b.data() + offset, chunk) != 0)
+            return static_cast<size_t>(std::mismatch(a.begin() + offset, a.begin() + offset + chunk, b.begin() + offset).first - a.begin());
+        offset += chunk;
+        a_file.release(offset);
+        b_file.release(offset);
+    }
+    return size;
+}
+
+/// @brief Excerpt of the diff line `text` of `data`: a long line is cut around the column of the
+///     `mismatch` offset. Cut ends and ends of lines which are not in the window are marked by "...".
+static std::string make_diff_line(std::string_view data, std::string_view text, size_t mismatch)
+{
+    static constexpr size_t MAX_LINE_LENGTH = 200u;
+
+    const size_t offset = static_cast<size_t>(text.data() - data.data());
+    size_t begin = 0u;
+    size_t end = text.size();
+    if (text.size() > MAX_LINE_LENGTH)
+    {
+        const size_t column = mismatch > offset ? std::min(mismatch - offset, text.size()) : 0u;
+        begin = column > MAX_LINE_LENGTH / 2u ? std::min(column - MAX_LINE_LENGTH / 2u, text.size() - MAX_LINE_LENGTH) : 0u;
+        end = begin + MAX_LINE_LENGTH;
+    }
+
+    std::string line;
+    if (offset + begin > 0u && (begin > 0u || data[offset - 1u] != '\n'))
+        line += "...";
+    line += text.substr(begin, end - begin);
+    if (offset + end < data.size() && (end < text.size() || data[offset + end] != '\n'))
+        line += "...";
+    return line;
+}
+
+/// @brief Make a bounded unified diff of `golden` and `actual` around the first difference.
+///
+/// Only a window of bytes around the first difference is compared, so the diff size and used
+/// memory don't depend on the size of the data and lengths of its lines.
+static std::string make_snapshot_diff(std::string_view golden, std::string_view actual, size_t mismatch,
+    const std::string & golden_path, mapped_file & golden_file)
+{
+    static constexpr size_t CHUNK_SIZE = 1024u * 1024u;
+    static constexpr size_t WINDOW_SIZE = 64u * 1024u;
+    static constexpr size_t CONTEXT_LINES = 3u;
+    static constexpr size_t WINDOW_LINES = 40u;
+
+    // Start of the window: a few lines before the line with the first difference. The data before
+    // the first difference are equal, so the window starts at the same offset in both texts.
+    const size_t min_start = mismatch > WINDOW_SIZE ? mismatch - WINDOW_SIZE : 0u;
+    size_t start = mismatch;
+    for (size_t lines = 0u; start > min_start; --start)
+    {
+        if (golden[start - 1u] == '\n' && lines++ == CONTEXT_LINES)
+            break;
+    }
+    size_t first_line = 1u;
+    for (size_t offset = 0u; offset < start; offset += CHUNK_SIZE)
+    {
+        const auto begin = golden.begin() + offset;
+        first_line += static_cast<size_t>(std::count(begin, begin + std::min(CHUNK_SIZE, start - offset), '\n'));
+        golden_file.release(offset);
+    }
+
+    const size_t window_end = mismatch + WINDOW_SIZE;
+    const auto take_lines = [start, window_end](std::string_view text, bool & truncated)
+    {
+        const std::string_view window = text.substr(0u, std::min(text.size(), window_end));
+        std::vector<std::string_view> lines;
+        size_t pos = start;
+        while (pos < window.size() && lines.size() < WINDOW_LINES)
+        {
+            size_t end = window.find('\n', pos);
+            if (end == std::string_view::npos)
+                end = window.size();
+            lines.push_back(window.substr(pos, end - pos));
+            pos = end + 1u;
+        }
+        truncated = pos < text.size();
+        return lines;
+    };
+
+    bool golden_truncated = false;
+    bool actual_truncated = false;
+    const std::vector<std::string_view> a = take_lines(golden, golden_truncated);
+    const std::vector<std::string_view> b = take_lines(actual, actual_truncated);
+
+    // Longest common subsequence of the windows.
+    std::vector<unsigned short> lcs((a.size() + 1u) * (b.size() + 1u), 0u);
+    const auto at = [&](size_t i, size_t j) -> unsigned short & { return lcs[i * (b.size() + 1u) + j]; };
+    for (size_t i = a.size(); i-- > 0u;)
+    {
+        for (size_t j = b.size(); j-- > 0u;)
+            at(i, j) = a[i] == b[j] ? at(i + 1u, j + 1u) + 1u : std::max(at(i + 1u, j), at(i, j + 1u));
+    }
+
+    std::vector<std::pair<char, std::string_view>> ops;
+    size_t i = 0u;
+    size_t j = 0u;
+    while (i < a.size() || j < b.size())
+    {
+        if (i < a.size() && j < b.size() && a[i] == b[j])
+        {
+            ops.emplace_back(' ', a[i++]);
+            ++j;
+        }
+        else if (i < a.size() && (j == b.size() || at(i + 1u, j) >= at(i, j + 1u)))
+        {
+            ops.emplace_back('-', a[i++]);
+        }
+        else
+        {
+            ops.emplace_back('+', b[j++]);
+        }
+    }
+
+    // Keep only a few context lines after the last change.
+    size_t last_change = 0u;
+    for (size_t k = 0u; k < ops.size(); ++k)
+    {
+        if (ops[k].first != ' ')
+            last_change = k;
+    }
+    const bool cut = last_change + CONTEXT_LINES + 1u < ops.size();
+    if (cut)
+        ops.resize(last_change + CONTEXT_LINES + 1u);
+
+    size_t golden_count = 0u;
+    size_t actual_count = 0u;
+    for (const auto & op : ops)
+    {
+        golden_count += op.first != '+' ? 1u : 0u;
+        actual_count += op.first != '-' ? 1u : 0u;
+    }
+
+    std::string diff;
+    diff += "--- " + golden_path + "\n";
+    diff += "+++ actual\n";
+    diff += "@@ -" + std::to_string(first_line) + "," + std::to_string(golden_count)
+        + " +" + std::to_string(first_line) + "," + std::to_string(actual_count) + " @@\n";
+    for (const auto & [op, text] : ops)
+    {
+        diff += op;
+        diff += make_diff_line(op == '+' ? actual : golden, text, mismatch);
+        diff += '\n';
+    }
+    if (!cut && (golden_truncated || actual_truncated))
+        diff += "... (diff is truncated)\n";
+
+    return diff;
+}
+
+using test_clock = std::chrono::steady_clock;
+
+static unsigned long long to_us(test_clock::duration duration)
+{
+    return static_cast<unsigned long long>(std::chrono::duration_cast<std::chrono::microseconds>(duration).count());
+}
+
+/// @brief Name of the profile file of the test: symbols which are unsafe for file names are replaced.
+///     Names of different tests can become equal, so an index is added to a name which is in `used`.
+static std::string profile_file_name(const std::string & test_name, std::unordered_set<std::string> & used)
+{
+    std::string name = test_name;
+    for (char & c : name)
+    {
+        if (!std::isalnum(static_cast<unsigned char>(c)) && c != '_' && c != '-' && c != '.')
+            c = '_';
+    }
+
+    std::string file_name = name + ".folded";
+    for (size_t index = 2u; !used.insert(file_name).second; ++index)
+        file_name = name + "_" + std::to_string(index) + ".folded";
+    return file_name;
+}
+
+/// @brief Written profile of a test.
+struct profile_info
+{
+    std::string path;
+    size_t samples = 0u;
+    size_t dropped = 0u;
+};
+
+/// @brief Serialization of the test results which are sent by the test process to the runner.
+static void put_size(std::string & out, size_t value)
+{
+    out.append(reinterpret_cast<const char *>(&value), sizeof(value));
+}
+
+static void put_text(std::string & out, std::string_view text)
+{
+    put_size(out, text.size());
+    out += text;
+}
+
+static bool get_size(std::string_view & in, size_t & value)
+{
+    if (in.size() < sizeof(value))
+        return false;
+    std::memcpy(&value, in.data(), sizeof(value));
+    in.remove_prefix(sizeof(value));
+    return true;
+}
+
+static bool get_text(std::string_view & in, std::string_view & text)
+{
+    size_t size = 0u;
+    if (!get_size(in, size) || in.size() < size)
+        return false;
+    text = in.substr(0u, size);
+    in.remove_prefix(size);
+    return true;
+}
+
+/// @brief Registered test.
+struct test_entry
+{
+    tupp::TestFunc func;
+#ifdef TUPP_COROUTINES
+    tupp::AsyncTestFunc async_func = nullptr;
+#endif
+};
+
+/// @brief State of the executed test: messages and result.
+struct test_context
+{
+    std::vector<case_record> records;
+    text_arena arena;
+    bool result = true;
+    std::string name;
+};
+
+#ifdef TUPP_COROUTINES
+/// @brief State of the executed async test.
+struct async_test_state
+{
+    std::string name;
+    tupp::AsyncTask task;
+    test_context context;
+    test_clock::time_point start;
+    bool finished = false;
+};
+#endif
+
+/// @brief Additional information about a test.
+struct test_info
+{
+    std::vector<std::string> tags;
+    unsigned long long expected_duration_ms = 0u;
+    unsigned int threads = 0u;
+    std::optional<size_t> max_rss_mb;
+};
+
+class tupp_internal
+{
+public:
+
+    tupp_internal() = default;
+
+    void set_line(size_t line);
+    void set_msg(std::string_view msg, bool static_msg = false);
+    void set_additionals(tupp::MsgList additionals);
+    void set_expected(std::string_view expected);
+    void assert(bool v);
+    void apply_case();
+    int run(int argc, char* argv[]);
+
+    void add_test(tupp::TestFunc func, std::string name);
+#ifdef TUPP_COROUTINES
+    void add_async_test(tupp::AsyncTestFunc func, std::string name);
+    void schedule(unsigned long long ms, int fd, bool write, std::coroutine_handle<> handle);
+#endif
+    void set_max_rss(const std::string & name, size_t max_rss_mb);
+    void set_tags(const std::string & name, std::vector<std::string> tags);
+    void set_hints(const std::string & name, unsigned long long expected_duration_ms, unsigned int threads);
+    void report_perf(std::optional<bool> v, std::string_view msg, tupp::MsgList additionals, size_t line,
+        bool static_msg = false);
+    void assert_snapshot(std::string_view name, std::string_view data, const std::string & data_path,
+        std::string_view msg, bool static_msg, size_t line, tupp::MsgList additionals);
+
+    void clear_case_params()
+    {
+        _case_params = std::nullopt;
+    }
+
+private:
+
+    enum class message_type
+    {
+        DEFAULT,
+        TEST_NAME,
+        TEST_MESSAGE,
+        HEADER,
+        FAIL,
+        SUCCESS,
+        REPORT,
+    };
+
+    void init_case_params();
+    status parse_cmd(int argc, char* argv[]);
+    static std::string parse_cmd_key(const std::string & arg);
+    status apply_cmd_params();
+    int handle_status(const status & st);
+    void print(message_type type, const std::string & message, bool cr) const;
+    static std::string make_tab(size_t tabs_count);
+
+    static void show_help();
+    static void show_version();
+    static void show_error(const std::string & error_msg);
+    int run_tests();
+
+    void emit_event(const json_builder & event);
+    void add_exception(const std::exception & e);
+    void add_text(std::string_view text);
+    bool finish_test(const std::string & test_name, test_clock::duration duration, std::optional<size_t> peak_rss_kb,
+        const profile_info & profile = profile_info());
+    void finish_run();
+    test_clock::duration call_test(const tupp::TestFunc & func);
+    profile_info write_profile(const std::string & test_name);
+#ifdef TUPP_PROC_MEMORY
+    bool run_isolated_test(const tupp::TestFunc & func, const std::string & test_name, size_t limit_kb,
+        test_clock::duration & duration, std::optional<size_t> & peak_rss_kb, profile_info & profile);
+#endif
+    void swap_context(test_context & context);
+#ifdef TUPP_COROUTINES
+    size_t run_async_tests(const std::vector<std::pair<const std::string *, tupp::AsyncTestFunc>> & tests);
+    void resume_async(async_test_state & test, std::coroutine_handle<> handle);
+    bool complete_async(async_test_state & test);
+#endif
+    int list_tests();
+    static std::string test_suite(const std::string & test_name);
+    status load_module(const std::string & path);
+
+private:
+
+    std::optional<case_params> _case_params;
+    std::vector<case_record> _case_records;
+    text_arena _case_arena;
+    bool _case_result = true;
+    std::string _current_test;
+
+    std::unique_ptr<event_writer> _events;
+    std::unique_ptr<memory_tracker> _memory;
+    std::unique_ptr<sampling_profiler> _profiler;
+    // Names of the written profile files.
+    std::unordered_set<std::string> _profile_names;
+    std::unordered_map<std::string, test_info> _tests_info;
+
+    /// @brief State of the tests run.
+    struct
+    {
+        size_t tests = 0u;
+        size_t failed = 0u;
+        size_t profiles = 0u;
+        test_clock::time_point start;
+    } _run;
+
+    std::unordered_map<std::string, std::vector<std::string>> _cmd_params;
+    std::unordered_set<std::string> _tests_to_run;
+    std::unordered_map<std::string, test_entry> _all_tests;
+    std::vector<const std::string *> _tests_order;
+    // Prefix of names of tests which are registered by the loading test module.
+    std::string _module_prefix;
+
+#ifdef TUPP_COROUTINES
+    struct async_waiter
+    {
+        async_test_state * test;
+        std::coroutine_handle<> handle;
+        int fd;
+        bool write;
+    };
+
+    std::multimap<test_clock::time_point, async_waiter> _async_timers;
+    std::vector<async_waiter> _async_fds;
+    async_test_state * _async_current = nullptr;
+#endif
+
+    struct
+    {
+        bool hide_all_messages = false;
+        bool hide_header = false;
+        bool hide_report = false;
+        bool hide_test_messages = false;
+        bool hide_test_names = false;
+        bool continue_after_assert = false;
+        bool show_memory = false;
+        size_t max_rss_mb = 0u;
+        bool list_tests = false;
+        std::string manifest_path;
+        bool update_snapshots = false;
+        std::string snapshot_dir = "snapshots";
+        std::string profile_dir;
+    } _config;
+};
+
+
+void tupp_internal::set_line(size_t line)
+{
+    init_case_params();
+    _case_params->line = line;
+}
+
+void tupp_internal::set_msg(std::string_view msg, bool static_msg)
+{
+    init_case_params();
+    _case_params->msg = msg;
+    _case_params->static_msg = static_msg;
+}
+
+void tupp_internal::set_additionals(tupp::MsgList additionals)
+{
+    init_case_params();
+    _case_params->additionals = additionals;
+}
+
+void tupp_internal::set_expected(std::string_view expected)
+{
+    init_case_params();
+    _case_params->expected = expected;
+}
+
+void tupp_internal::assert(bool v)
+{
+    _case_params->assert_result = v;
+}
+
+void tupp_internal::apply_case()
+{
+    if (!_case_params)
+        return;
+
+    struct cleaner
+    {
+        tupp_internal * internal;
+        explicit cleaner(tupp_internal * internal) : internal(internal) {}
+        ~cleaner() { internal->clear_case_params(); }
+    } obj_cleaner(this);
+
+    case_record record;
+    if (!_case_params->has_result())
+    {
+        if (!_case_params->has_msg() && !_case_params->has_additional())
+            return;
+
+        record.type = case_record::record_type::MESSAGE;
+    }
+    else
+    {
+        if (_case_params->get_result())
+            return;
+
+        _case_result = false;
+        record.type = case_record::record_type::FAIL;
+    }
+
+    record.line = _case_params->line;
+    record.msg = _case_params->static_msg ? _case_params->msg : _case_arena.store(_case_params->msg);
+    record.expected = _case_arena.store(_case_params->expected);
+    record.additional_msg = _case_arena.store(_case_params->additionals);
+    _case_records.push_back(record);
+
+    if (_events && record.type == case_record::record_type::MESSAGE)
+    {
+        std::string text(record.msg);
+        if (!text.empty() && !record.additional_msg.empty())
+            text += " ";
+        text += record.additional_msg;
+        emit_event(event_builder("message")
+            .add("test", _current_test)
+            .add("line", record.line.value_or(0u))
+            .add("text", text));
+    }
+    else if (_events)
+    {
+        emit_event(event_builder("assert_failed")
+            .add("test", _current_test)
+            .add("line", record.line.value_or(0u))
+            .add("expression", record.msg)
+            .add("expected", record.expected)
+            .add("message", record.additional_msg));
+    }
+
+    if (_case_params->has_result() && !_config.continue_after_assert)
+        throw tupp_exception();
+}
+
+void tupp_internal::report_perf(std::optional<bool> v, std::string_view msg, tupp::MsgList additionals, size_t line,
+    bool static_msg)
+{
+    set_msg(msg, static_msg);
+    set_additionals(additionals);
+    set_line(line);
+    if (v)
+        assert(*v);
+    apply_case();
+}
+
+void tupp_internal::assert_snapshot(std::string_view name, std::string_view data, const std::string & data_path,
+    std::string_view msg, bool static_msg, size_t line, tupp::MsgList additionals)
+{
+    const std::filesystem::path golden_path = std::filesystem::path(_config.snapshot_dir) / std::filesystem::path(name);
+    std::string result;
+    std::string diff;
+    std::optional<bool> v;
+
+    mapped_file data_file;
+    if (!data_path.empty() && !data_file.open(data_path))
+    {
+        result = "can not open file '" + data_path + "'";
+        v = false;
+    }
+    else if (!data_path.empty())
+    {
+        data = data_file.data();
+    }
+
+    if (v.has_value())
+    {
+        // Error is already found.
+    }
+    else if (_config.update_snapshots)
+    {
+        std::error_code ec;
+        if (golden_path.has_parent_path())
+            std::filesystem::create_directories(golden_path.parent_path(), ec);
+
+        bool written = false;
+        if (!data_path.empty())
+        {
+            written = std::filesystem::copy_file(data_path, golden_path,
+                std::filesystem::copy_options::overwrite_existing, ec);
+        }
+        else if (std::FILE * file = std::fopen(golden_path.string().c_str(), "wb"))
+        {
+            written = std::fwrite(data.data(), 1u, data.size(), file) == data.size();
+            written = std::fclose(file) == 0 && written;
+        }
+
+        if (written)
+        {
+            result = "is updated: '" + golden_path.string() + "'";
+        }
+        else
+        {
+            result = "can not write golden file '" + golden_path.string() + "'";
+            v = false;
+        }
+    }
+    else
+    {
+        mapped_file golden;
+        if (!golden.open(golden_path.string()))
+        {
+            result = "golden file '" + golden_path.string() + "' is not found (use --update-snapshots)";
+            v = false;
+        }
+        else if (const size_t mismatch = find_mismatch(golden.data(), data, golden, data_file);
+            mismatch == golden.data().size() && mismatch == data.size())
+        {
+            v = true;
+        }
+        else
+        {
+            const std::string_view expected = golden.data();
+            result = "differs from golden file '" + golden_path.string() + "' at byte " + std::to_string(mismatch)
+                + " (golden size: " + std::to_string(expected.size())
+                + ", actual size: " + std::to_string(data.size()) + ")";
+            diff = make_snapshot_diff(expected, data, mismatch, golden_path.string(), golden);
+            v = false;
+        }
+    }
+
+    const std::string user_msg = join_additionals(additionals);
+    if (!user_msg.empty())
+        result += " " + user_msg;
+    if (!diff.empty())
+    {
+        diff.pop_back(); // The last line break.
+        result += "\n" + diff;
+    }
+
+    // Named list keeps its array alive until the case is applied.
+    const tupp::MsgList result_list = {result};
+    set_msg(msg, static_msg);
+    set_additionals(result_list);
+    set_line(line);
+    if (v)
+        assert(*v);
+    apply_case();
+}
+
+int tupp_internal::run(int argc, char* argv[])
+{
+    status st = parse_cmd(argc, argv);
+    if (st.code != status::status_code::SUCCESS)
+        return handle_status(st);
+
+    st = apply_cmd_params();
+    return handle_status(st);
+}
+
+void tupp_internal::add_test(tupp::TestFunc func, std::string name)
+{
+    if (!_module_prefix.empty())
+        name.insert(0u, _module_prefix);
+    const auto [it, inserted] = _all_tests.emplace(std::move(name), test_entry{std::move(func)});
+    if (inserted)
+        _tests_order.push_back(&it->first);
+}
+
+#ifdef TUPP_COROUTINES
+void tupp_internal::add_async_test(tupp::AsyncTestFunc func, std::string name)
+{
+    test_entry entry;
+    entry.async_func = func;
+    if (!_module_prefix.empty())
+        name.insert(0u, _module_prefix);
+    const auto [it, inserted] = _all_tests.emplace(std::move(name), std::move(entry));
+    if (inserted)
+        _tests_order.push_back(&it->first);
+}
+
+void tupp_internal::schedule(unsigned long long ms, int fd, bool write, std::coroutine_handle<> handle)
+{
+    if (!_async_current)
+        throw std::logic_error("Async waiting is allowed only in async tests");
+
+    if (fd < 0)
+    {
+        const test_clock::time_point deadline = test_clock::now() + std::chrono::milliseconds(ms);
+        _async_timers.emplace(deadline, async_waiter{_async_current, handle, -1, false});
+        return;
+    }
+
+#ifdef TUPP_POSIX
+    _async_fds.push_back(async_waiter{_async_current, handle, fd, write});
+#else
+    throw std::logic_error("Waiting for file descriptors is not supported on this system");
+#endif
+}
+#endif
+
+void tupp_internal::set_max_rss(const std::string & name, size_t max_rss_mb)
+{
+    _tests_info[_module_prefix + name].max_rss_mb = max_rss_mb;
+}
+
+void tupp_internal::set_tags(const std::string & name, std::vector<std::string> tags)
+{
+    _tests_info[_module_prefix + name].tags = std::move(tags);
+}
+
+void tupp_internal::set_hints(const std::string & name, unsigned long long expected_duration_ms, unsigned int threads)
+{
+    test_info & info = _tests_info[_module_prefix + name];
+    info.expected_duration_ms = expected_duration_ms;
+    info.threads = threads;
+}
+
+void tupp_internal::init_case_params()
+{
+    if (!_case_params)
+        _case_params = case_params();
+}
+
+status tupp_internal::parse_cmd(int argc, char* argv[])
+{
+    std::string key;
+    for (int i = 1 /* Skip exe file. */; i < argc; ++i)
+    {
+        std::string s_argv(argv[i]);
+        if (const std::string new_key = parse_cmd_key(s_argv); !new_key.empty())
+        {
+            if (!key.empty())
+                _cmd_params.emplace(key, std::vector<std::string>());
+            key = new_key;
+        }
+        else
+        {
+            if (key.empty())
+                return {status::status_code::BAD_CMD, "Invalid key: '" + s_argv + "'"};
+
+            auto it = _cmd_params.find(key);
+            if (it == _cmd_params.end())
+                it = _cmd_params.emplace(key, std::vector<std::string>()).first;
+            it->second.push_back(s_argv);
+        }
+    }
+
+    if (!key.empty())
+        _cmd_params.emplace(key, std::vector<std::string>());
+
+    return {status::status_code::SUCCESS};
+}
+
+std::string tupp_internal::parse_cmd_key(const std::string & arg)
+{
+    if (arg.empty())
+        return {};
 
     if (arg.size() == 2u && arg[0u] == '-' && arg[1u] != '-')
         return std::string(1u, arg[1u]);
@@ -371,6 +1867,121 @@ status tupp_internal::apply_cmd_params()
                 return {status::status_code::INVALID_KEY, "Key '" + key + "' doesn't have any value"};
             _config.continue_after_assert = true;
         }
+        else if (key == "l" || key == "list")
+        {
+            if (!values.empty())
+                return {status::status_code::INVALID_KEY, "Key '" + key + "' doesn't have any value"};
+            _config.list_tests = true;
+        }
+        else if (key == "manifest")
+        {
+            if (values.empty())
+                return {status::status_code::INVALID_KEY, "Needed value for '" + key + "'"};
+
+            if (values.size() > 1u)
+                return {status::status_code::INVALID_KEY_USAGE, "Multiple use of key '" + key + "'"};
+
+            _config.manifest_path = values[0u];
+        }
+        else if (key == "update-snapshots")
+        {
+            if (!values.empty())
+                return {status::status_code::INVALID_KEY, "Key '" + key + "' doesn't have any value"};
+            _config.update_snapshots = true;
+        }
+        else if (key == "snapshot-dir")
+        {
+            if (values.empty())
+                return {status::status_code::INVALID_KEY, "Needed value for '" + key + "'"};
+
+            if (values.size() > 1u)
+                return {status::status_code::INVALID_KEY_USAGE, "Multiple use of key '" + key + "'"};
+
+            _config.snapshot_dir = values[0u];
+        }
+        else if (key == "module")
+        {
+            if (values.empty())
+                return {status::status_code::INVALID_KEY, "Needed value for '" + key + "'"};
+
+            for (const auto & value : values)
+            {
+                if (status st = load_module(value); st.code != status::status_code::SUCCESS)
+                    return st;
+            }
+        }
+        else if (key == "profile")
+        {
+            if (values.empty())
+                return {status::status_code::INVALID_KEY, "Needed value for '" + key + "'"};
+
+            if (values.size() > 1u)
+                return {status::status_code::INVALID_KEY_USAGE, "Multiple use of key '" + key + "'"};
+
+            _config.profile_dir = values[0u];
+        }
+        else if (key == "m" || key == "memory")
+        {
+            if (!values.empty())
+                return {status::status_code::INVALID_KEY, "Key '" + key + "' doesn't have any value"};
+            _config.show_memory = true;
+        }
+        else if (key == "max-rss")
+        {
+            if (values.empty())
+                return {status::status_code::INVALID_KEY, "Needed value for '" + key + "'"};
+
+            if (values.size() > 1u)
+                return {status::status_code::INVALID_KEY_USAGE, "Multiple use of key '" + key + "'"};
+
+            try
+            {
+                size_t pos;
+                _config.max_rss_mb = std::stoul(values[0u], &pos);
+                if (pos != values[0u].size() || _config.max_rss_mb == 0u)
+                    throw std::invalid_argument(key);
+            }
+            catch(const std::exception &)
+            {
+                return {status::status_code::INVALID_KEY, "Invalid value for '" + key + "'"};
+            }
+        }
+        else if (key == "e" || key == "events")
+        {
+            if (values.empty())
+                return {status::status_code::INVALID_KEY, "Needed value for '" + key + "'"};
+
+            if (values.size() > 1u)
+                return {status::status_code::INVALID_KEY_USAGE, "Multiple use of key '" + key + "'"};
+
+#ifdef TUPP_POSIX
+            const bool is_fd = values[0u].find_first_not_of("0123456789") == std::string::npos;
+#else
+            const bool is_fd = false;
+#endif
+            int fd = -1;
+            if (is_fd)
+            {
+                try
+                {
+                    size_t pos;
+                    fd = std::stoi(values[0u], &pos);
+                    if (pos != values[0u].size())
+                        throw std::invalid_argument(key);
+                }
+                catch(const std::exception &)
+                {
+                    return {status::status_code::INVALID_KEY, "Invalid value for '" + key + "'"};
+                }
+            }
+
+            _events = std::make_unique<event_writer>();
+            if (!(is_fd ? _events->open_fd(fd) : _events->open_file(values[0u])))
+            {
+                _events.reset();
+                return {status::status_code::INVALID_KEY, "Can not open events stream '" + values[0u] + "'"};
+            }
+        }
         else
         {
             return {status::status_code::INVALID_KEY, "Unknown key '" + key + "'"};
@@ -382,6 +1993,9 @@ status tupp_internal::apply_cmd_params()
     if (result == status::status_code::_UNDEFINED)
         result = status::status_code::RUN_TEST;
 
+    if (_config.list_tests || !_config.manifest_path.empty())
+        result = status::status_code::RUN_LIST;
+
     return result;
 }
 
@@ -416,6 +2030,9 @@ void tupp_internal::print(message_type type, const std::string & message, bool c
         if (_config.hide_test_messages)
             return;
         msg = make_tab(2u) + message;
+        // Continuation lines of a multiline message (a diff, a table) have the same indent.
+        for (size_t pos = msg.find('\n'); pos != std::string::npos; pos = msg.find('\n', pos + 1u))
+            msg.insert(pos + 1u, make_tab(2u));
         break;
 
     case message_type::REPORT:
@@ -454,6 +2071,12 @@ int tupp_internal::handle_status(const status & st)
     case status::status_code::INVALID_KEY_USAGE:
         show_error(st.msg);
         return 102;
+    case status::status_code::MODULE_ERROR:
+        show_error(st.msg);
+        return 103;
+    case status::status_code::OUTPUT_ERROR:
+        show_error(st.msg);
+        return 104;
     case status::status_code::RUN_HELP:
         show_help();
         return 0;
@@ -462,6 +2085,8 @@ int tupp_internal::handle_status(const status & st)
     case status::status_code::RUN_VERSION:
         show_version();
         return 0;
+    case status::status_code::RUN_LIST:
+        return list_tests();
     case status::status_code::SUCCESS:
         return 0;
     case status::status_code::_UNDEFINED:
@@ -472,96 +2097,716 @@ int tupp_internal::handle_status(const status & st)
     default:
         return 0;
     }
-}
+}
+
+void tupp_internal::show_help()
+{
+    std::cout << "-a --continue_after_assert  Continue to run test after fail assert." << std::endl;
+    std::cout << "-e --events [fd|path]       Write machine-readable events (JSON lines) to the" << std::endl;
+    std::cout << "                              file descriptor or the file." << std::endl;
+    std::cout << "-h --help                   Show this help." << std::endl;
+    std::cout << "-l --list                   Show names of tests without execution." << std::endl;
+    std::cout << "   --manifest [path]        Write tests manifest (JSON lines) without execution." << std::endl;
+    std::cout << "-m --memory                 Show peak resident memory of every test." << std::endl;
+    std::cout << "   --max-rss [MB]           Fail tests which resident memory exceeds the limit." << std::endl;
+    std::cout << "   --module [path]          Load tests from the test module (shared library)." << std::endl;
+    std::cout << "   --profile [dir]          Write sampled stacks of every test (collapsed stacks" << std::endl;
+    std::cout << "                              for flame graphs) to the directory." << std::endl;
+    std::cout << "-s --silent_level [level]   Hide some messages during tests execute." << std::endl;
+    std::cout << "                              level:" << std::endl;
+    std::cout << "                              0: Show all messages." << std::endl;
+    std::cout << "                              1: Hide test messages" << std::endl;
+    std::cout << "                              2: Hide test messages and test results." << std::endl;
+    std::cout << "                              +10: Hide headers." << std::endl;
+    std::cout << "                              +100: Hide report." << std::endl;
+    std::cout << "                              1000: Hide all messages." << std::endl;
+    std::cout << "                              Example: 11 - hide test messages and headers." << std::endl;
+    std::cout << "   --snapshot-dir [dir]     Directory of golden files (default: snapshots)." << std::endl;
+    std::cout << "   --update-snapshots       Rewrite golden files by checked data." << std::endl;
+    std::cout << "-t --test [test_name]       Execute test with specified name." << std::endl;
+    std::cout << "-v --version                Show version." << std::endl;
+}
+
+void tupp_internal::show_version()
+{
+    std::cout << PROG_NAME
+        << " v" << PROG_VER_MAJ << "." << PROG_VER_MIN << "." << PROG_VER_COR << std::endl;
+    std::cout << PROG_COPYRIGHT << std::endl;
+    std::cout << PROG_URL << std::endl;
+}
+
+void tupp_internal::show_error(const std::string & error_msg)
+{
+    std::cout << PROG_NAME << std::endl;
+    std::cout << error_msg << std::endl;
+}
+
+void tupp_internal::emit_event(const json_builder & event)
+{
+    _events->write(event.str());
+}
+
+std::string tupp_internal::test_suite(const std::string & test_name)
+{
+    const size_t pos = test_name.rfind("::");
+    return pos == std::string::npos ? std::string() : test_name.substr(0u, pos);
+}
+
+int tupp_internal::list_tests()
+{
+    // Tests are listed in the registration order.
+    std::vector<const std::string *> names;
+    names.reserve(_tests_order.size());
+    for (const std::string * name : _tests_order)
+    {
+        if (_tests_to_run.count(*name) > 0u || _tests_to_run.empty())
+            names.push_back(name);
+    }
+
+    if (_config.list_tests)
+    {
+        std::string list;
+        for (const std::string * name : names)
+        {
+            list += *name;
+            list += '\n';
+        }
+        std::fwrite(list.data(), 1u, list.size(), stdout);
+        std::fflush(stdout);
+    }
+
+    if (!_config.manifest_path.empty())
+    {
+        std::FILE * file = std::fopen(_config.manifest_path.c_str(), "wb");
+        if (!file)
+        {
+            return handle_status({status::status_code::OUTPUT_ERROR,
+                "Can not open manifest file '" + _config.manifest_path + "'"});
+        }
+
+        std::string manifest;
+        for (const std::string * name : names)
+        {
+            json_builder test;
+            test.add("name", *name);
+            if (const std::string suite = test_suite(*name); !suite.empty())
+                test.add("suite", suite);
+
+            if (const auto it = _tests_info.find(*name); it != _tests_info.end())
+            {
+                const test_info & info = it->second;
+                if (!info.tags.empty())
+                    test.add("tags", info.tags);
+                if (info.expected_duration_ms > 0u)
+                    test.add("expected_duration_ms", info.expected_duration_ms);
+                if (info.threads > 0u)
+                    test.add("threads", info.threads);
+                if (info.max_rss_mb)
+                    test.add("max_rss_mb", *info.max_rss_mb);
+            }
+
+            test.append_to(manifest);
+            manifest += '\n';
+        }
+
+        const bool written = std::fwrite(manifest.data(), 1u, manifest.size(), file) == manifest.size();
+        if (std::fclose(file) != 0 || !written)
+        {
+            return handle_status({status::status_code::OUTPUT_ERROR,
+                "Can not write manifest file '" + _config.manifest_path + "'"});
+        }
+    }
+
+    return handle_status(status(status::status_code::SUCCESS));
+}
+
+status tupp_internal::load_module(const std::string & path)
+{
+#ifdef TUPP_MODULES
+    // A name without a slash is searched in library directories, so an existing file is used
+    // by its path.
+    std::error_code ec;
+    const std::string file = path.find('/') == std::string::npos && std::filesystem::exists(path, ec)
+        ? "./" + path : path;
+
+    // Tests of the module refer to its code, so the module is never unloaded.
+    void * handle = ::dlopen(file.c_str(), RTLD_NOW | RTLD_LOCAL);
+    if (!handle)
+        return {status::status_code::MODULE_ERROR, "Can not load test module '" + path + "': " + ::dlerror()};
+
+    using register_func = void (*)();
+    const auto func = reinterpret_cast<register_func>(::dlsym(handle, "tupp_module_register"));
+    if (!func)
+        return {status::status_code::MODULE_ERROR, "Test module '" + path + "' doesn't have entry point (TUPP_MODULE)"};
+
+    _module_prefix = std::filesystem::path(path).stem().string() + "::";
+    try
+    {
+        func();
+    }
+    catch (const std::exception & e)
+    {
+        _module_prefix.clear();
+        return {status::status_code::MODULE_ERROR, "Test module '" + path + "' registration error: " + e.what()};
+    }
+    _module_prefix.clear();
+    return {status::status_code::SUCCESS};
+#else
+    return {status::status_code::MODULE_ERROR, "Test modules are unavailable on this system ('" + path + "')"};
+#endif
+}
+
+void tupp_internal::add_text(std::string_view text)
+{
+    case_record record;
+    record.type = case_record::record_type::TEXT;
+    record.msg = _case_arena.store(text);
+    _case_records.push_back(record);
+}
+
+void tupp_internal::add_exception(const std::exception & e)
+{
+    add_text("  Exception: " + std::string(e.what()));
+    _case_result = false;
+    if (_events)
+        emit_event(event_builder("exception").add("test", _current_test).add("what", e.what()));
+}
+
+bool tupp_internal::finish_test(const std::string & test_name, test_clock::duration duration, std::optional<size_t> peak_rss_kb,
+    const profile_info & profile)
+{
+    const bool result = _case_result;
+    if (result)
+        print(message_type::SUCCESS, "SUCCESS", true);
+    else
+        print(message_type::FAIL, "FAIL", true);
+
+    if (!_config.hide_all_messages && !_config.hide_test_messages)
+    {
+        for (const case_record & record : _case_records)
+            print(message_type::TEST_MESSAGE, record.format(), true);
+    }
+
+    if (_events)
+    {
+        event_builder event("test_finished");
+        event.add("test", test_name)
+            .add("result", result ? "success" : "fail")
+            .add("duration_us", to_us(duration));
+        if (peak_rss_kb)
+            event.add("peak_rss_kb", *peak_rss_kb);
+        if (!profile.path.empty())
+        {
+            event.add("profile", profile.path).add("profile_samples", profile.samples);
+            if (profile.dropped > 0u)
+                event.add("profile_dropped", profile.dropped);
+        }
+        emit_event(event);
+        _events->flush(false);
+    }
+
+    _case_records.clear();
+    _case_arena.reset();
+    _case_result = true;
+    _current_test.clear();
+    return result;
+}
+
+void tupp_internal::swap_context(test_context & context)
+{
+    std::swap(_case_records, context.records);
+    std::swap(_case_arena, context.arena);
+    std::swap(_case_result, context.result);
+    std::swap(_current_test, context.name);
+    _case_params = std::nullopt;
+}
+
+int tupp_internal::run_tests()
+{
+    print(message_type::HEADER, "START", true);
+    _run.tests = _tests_to_run.empty() ? _all_tests.size() : _tests_to_run.size();
+    if (_events)
+        emit_event(event_builder("run_started").add("tests", _run.tests).add("total", _all_tests.size()));
+
+    // Tests with a memory limit are run in child processes, so the tracker of this process is
+    // needed only for displaying of the peak memory.
+    const bool track_memory = _config.show_memory || _config.max_rss_mb > 0u
+        || std::any_of(_tests_info.begin(), _tests_info.end(), [](const auto & info) { return info.second.max_rss_mb.value_or(0u) > 0u; });
+    if (track_memory && !memory_tracker::available())
+        print(message_type::REPORT, "Memory tracking is unavailable on this system", true);
+    else if (_config.show_memory)
+        _memory = std::make_unique<memory_tracker>();
+
+    if (!_config.profile_dir.empty() && sampling_profiler::available())
+    {
+        std::error_code ec;
+        std::filesystem::create_directories(_config.profile_dir, ec);
+        _profiler = std::make_unique<sampling_profiler>();
+    }
+    else if (!_config.profile_dir.empty())
+    {
+        print(message_type::REPORT, "Profiling is unavailable on this system", true);
+    }
+
+    _run.start = test_clock::now();
+#ifdef TUPP_COROUTINES
+    std::vector<std::pair<const std::string *, tupp::AsyncTestFunc>> async_tests;
+#endif
+    for (const auto & [test_name, test] : _all_tests)
+    {
+        if (_tests_to_run.count(test_name) > 0u || _tests_to_run.empty())
+        {
+#ifdef TUPP_COROUTINES
+            if (test.async_func)
+            {
+                async_tests.emplace_back(&test_name, test.async_func);
+                continue;
+            }
+#endif
+
+            print(message_type::TEST_NAME, "TEST '" + test_name + "': ", false);
+            _current_test = test_name;
+            if (_events)
+                emit_event(event_builder("test_started").add("test", test_name));
+
+            size_t max_rss_mb = _config.max_rss_mb;
+            if (const auto it = _tests_info.find(test_name); it != _tests_info.end() && it->second.max_rss_mb)
+                max_rss_mb = *it->second.max_rss_mb;
+
+            test_clock::duration test_duration{};
+            std::optional<size_t> peak_rss_kb;
+            profile_info profile;
+            bool isolated = false;
+#ifdef TUPP_PROC_MEMORY
+            if (max_rss_mb > 0u && memory_tracker::available())
+            {
+                isolated = run_isolated_test(test.func, test_name, max_rss_mb * 1024u, test_duration, peak_rss_kb, profile);
+                if (!isolated)
+                    add_text("Can not start the test process, the memory limit is not applied");
+            }
+#endif
+            if (!isolated)
+            {
+                if (_memory)
+                    _memory->start();
+                test_duration = call_test(test.func);
+                if (_memory)
+                {
+                    peak_rss_kb = _memory->stop();
+                    add_text("Peak RSS: " + std::to_string(*peak_rss_kb) + " KB");
+                }
+                profile = write_profile(test_name);
+            }
+
+            if (!finish_test(test_name, test_duration, peak_rss_kb, profile))
+                ++_run.failed;
+        }
+    }
+
+    _memory.reset();
+    _profiler.reset();
+
+#ifdef TUPP_COROUTINES
+    if (!async_tests.empty())
+        _run.failed += run_async_tests(async_tests);
+#endif
+
+    finish_run();
+
+    if (_run.failed > 0u)
+        return handle_status(status(status::status_code::TESTS_FAIL));
+    else
+        return handle_status(status(status::status_code::SUCCESS));
+}
+
+void tupp_internal::finish_run()
+{
+    const size_t run_count = _run.tests;
+    print(message_type::HEADER, "FINISH", true);
+    std::string report_msg;
+    report_msg += "Run: " + std::to_string(run_count) + "/" + std::to_string(_all_tests.size());
+    report_msg += ", Fail: " + std::to_string(_run.failed);
+    report_msg += ", Pass: " + std::to_string(run_count - _run.failed);
+    print(message_type::REPORT, report_msg, true);
+    if (_run.profiles > 0u)
+        print(message_type::REPORT, "Profiles: " + std::to_string(_run.profiles) + " in '" + _config.profile_dir + "'", true);
+
+    if (_events)
+    {
+        // The buffer is drained, so the summary is never dropped.
+        const unsigned long long duration_us = to_us(test_clock::now() - _run.start);
+        _events->flush(true);
+        event_builder event("summary");
+        event.add("run", run_count)
+            .add("total", _all_tests.size())
+            .add("fail", _run.failed)
+            .add("pass", run_count - _run.failed)
+            .add("duration_us", duration_us);
+        if (_events->dropped() > 0u)
+            event.add("dropped", _events->dropped());
+        emit_event(event);
+        _events->flush(true);
+    }
+}
+
+test_clock::duration tupp_internal::call_test(const tupp::TestFunc & func)
+{
+    if (_profiler)
+        _profiler->start();
+    const test_clock::time_point test_start = test_clock::now();
+    try
+    {
+        _case_params = std::nullopt;
+        func();
+    }
+    catch (const tupp_exception &)
+    {
+        // Nothing do.
+    }
+    catch (const std::exception & e)
+    {
+        add_exception(e);
+    }
+    const test_clock::duration duration = test_clock::now() - test_start;
+    if (_profiler)
+        _profiler->stop();
+    return duration;
+}
+
+profile_info tupp_internal::write_profile(const std::string & test_name)
+{
+    // A profile is written only if the test has samples. Its path is reported by events.
+    profile_info profile;
+    if (!_profiler || _profiler->samples() == 0u)
+        return profile;
+
+    const std::string path = (std::filesystem::path(_config.profile_dir)
+        / profile_file_name(test_name, _profile_names)).string();
+    if (_profiler->write(path))
+    {
+        profile.path = path;
+        profile.samples = _profiler->samples();
+        profile.dropped = _profiler->dropped();
+        ++_run.profiles;
+    }
+    else
+    {
+        add_text("Can not write profile '" + path + "'");
+    }
+    return profile;
+}
+
+#ifdef TUPP_PROC_MEMORY
+bool tupp_internal::run_isolated_test(const tupp::TestFunc & func, const std::string & test_name, size_t limit_kb,
+    test_clock::duration & duration, std::optional<size_t> & peak_rss_kb, profile_info & profile)
+{
+    // Buffered output would be written by both processes.
+    std::cout.flush();
+    std::fflush(nullptr);
+    if (_events)
+        _events->flush(true);
+
+    int fds[2];
+    if (::pipe2(fds, O_CLOEXEC) != 0)
+        return false;
+
+    const test_clock::time_point test_start = test_clock::now();
+    const pid_t pid = ::fork();
+    if (pid < 0)
+    {
+        ::close(fds[0]);
+        ::close(fds[1]);
+        return false;
+    }
+
+    if (pid == 0)
+    {
+        // The test process: run the test and send its results to the runner.
+        ::close(fds[0]);
+        const test_clock::duration test_duration = call_test(func);
+        const profile_info test_profile = write_profile(test_name);
+
+        std::string out;
+        put_size(out, _case_result ? 1u : 0u);
+        put_size(out, static_cast<size_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(test_duration).count()));
+        put_text(out, test_profile.path);
+        put_size(out, test_profile.samples);
+        put_size(out, test_profile.dropped);
+        put_size(out, _case_records.size());
+        for (const case_record & record : _case_records)
+        {
+            put_size(out, static_cast<size_t>(record.type));
+            put_size(out, record.line ? *record.line + 1u : 0u);
+            put_text(out, record.msg);
+            put_text(out, record.expected);
+            put_text(out, record.additional_msg);
+        }
+        for (size_t pos = 0u; pos < out.size();)
+        {
+            const ssize_t res = ::write(fds[1], out.data() + pos, out.size() - pos);
+            if (res > 0)
+                pos += static_cast<size_t>(res);
+            else if (errno != EINTR)
+                break;
+        }
+
+        if (_events)
+            _events->flush(true);
+        std::cout.flush();
+        std::fflush(nullptr);
+        std::_Exit(EXIT_SUCCESS);
+    }
+
+    // The runner: read the results and kill the test process if its memory exceeds the limit.
+    ::close(fds[1]);
+    std::string data;
+    bool killed = false;
+    size_t sampled_kb = 0u;
+    for (;;)
+    {
+        pollfd pfd = {fds[0], POLLIN, 0};
+        if (::poll(&pfd, 1, static_cast<int>(memory_tracker::SAMPLE_PERIOD.count())) > 0)
+        {
+            char buffer[4096];
+            const ssize_t res = ::read(fds[0], buffer, sizeof(buffer));
+            if (res > 0)
+                data.append(buffer, static_cast<size_t>(res));
+            else if (res == 0 || errno != EINTR)
+                break;
+        }
+        sampled_kb = std::max(sampled_kb, memory_tracker::current_rss_kb(pid));
+        if (!killed && sampled_kb > limit_kb)
+        {
+            ::kill(pid, SIGKILL);
+            killed = true;
+        }
+    }
+    ::close(fds[0]);
 
-void tupp_internal::show_help()
-{
-    std::cout << "-a --continue_after_assert  Continue to run test after fail assert." << std::endl;
-    std::cout << "-h --help                   Show this help." << std::endl;
-    std::cout << "-s --silent_level [level]   Hide some messages during tests execute." << std::endl;
-    std::cout << "                              level:" << std::endl;
-    std::cout << "                              0: Show all messages." << std::endl;
-    std::cout << "                              1: Hide test messages" << std::endl;
-    std::cout << "                              2: Hide test messages and test results." << std::endl;
-    std::cout << "                              +10: Hide headers." << std::endl;
-    std::cout << "                              +100: Hide report." << std::endl;
-    std::cout << "                              1000: Hide all messages." << std::endl;
-    std::cout << "                              Example: 11 - hide test messages and headers." << std::endl;
-    std::cout << "-t --test [test_name]       Execute test with specified name." << std::endl;
-    std::cout << "-v --version                Show version." << std::endl;
-}
+    int status = 0;
+    struct rusage usage = {};
+    while (::wait4(pid, &status, 0, &usage) < 0 && errno == EINTR)
+    {
+    }
+    duration = test_clock::now() - test_start;
+    // The kernel peak of a killed process can be behind the last sample.
+    peak_rss_kb = std::max(static_cast<size_t>(usage.ru_maxrss), sampled_kb);
+
+    std::string_view in = data;
+    size_t result = 0u;
+    size_t duration_ns = 0u;
+    size_t records = 0u;
+    std::string_view profile_path;
+    bool finished = WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS
+        && get_size(in, result) && get_size(in, duration_ns) && get_text(in, profile_path)
+        && get_size(in, profile.samples) && get_size(in, profile.dropped) && get_size(in, records);
+    for (size_t i = 0u; finished && i < records; ++i)
+    {
+        size_t type = 0u;
+        size_t line = 0u;
+        case_record record;
+        finished = get_size(in, type) && get_size(in, line) && get_text(in, record.msg)
+            && get_text(in, record.expected) && get_text(in, record.additional_msg);
+        record.type = static_cast<case_record::record_type>(type);
+        if (line > 0u)
+            record.line = line - 1u;
+        record.msg = _case_arena.store(record.msg);
+        record.expected = _case_arena.store(record.expected);
+        record.additional_msg = _case_arena.store(record.additional_msg);
+        if (finished)
+            _case_records.push_back(record);
+    }
 
-void tupp_internal::show_version()
-{
-    std::cout << PROG_NAME
-        << " v" << PROG_VER_MAJ << "." << PROG_VER_MIN << "." << PROG_VER_COR << std::endl;
-    std::cout << PROG_COPYRIGHT << std::endl;
-    std::cout << PROG_URL << std::endl;
-}
+    if (finished)
+    {
+        _case_result = result != 0u;
+        duration = std::chrono::duration_cast<test_clock::duration>(std::chrono::nanoseconds(duration_ns));
+        if (!profile_path.empty())
+        {
+            profile.path = std::string(profile_path);
+            _profile_names.insert(std::filesystem::path(profile.path).filename().string());
+            ++_run.profiles;
+        }
+    }
+    else
+    {
+        _case_result = false;
+        profile = profile_info();
+    }
 
-void tupp_internal::show_error(const std::string & error_msg)
-{
-    std::cout << PROG_NAME << std::endl;
-    std::cout << error_msg << std::endl;
+    if (killed || *peak_rss_kb > limit_kb)
+    {
+        add_text("Fail Peak RSS: " + std::to_string(*peak_rss_kb) + " KB (expected: <= " + std::to_string(limit_kb)
+            + " KB)" + (killed ? ". The test is killed" : ""));
+        _case_result = false;
+    }
+    else if (!finished && WIFSIGNALED(status))
+    {
+        add_text("Fail The test process is killed by signal " + std::to_string(WTERMSIG(status)));
+    }
+    else if (!finished)
+    {
+        add_text("Fail The test process is finished with code " + std::to_string(WEXITSTATUS(status)));
+    }
+    else if (_config.show_memory)
+    {
+        add_text("Peak RSS: " + std::to_string(*peak_rss_kb) + " KB");
+    }
+    return true;
 }
+#endif
 
-int tupp_internal::run_tests()
+#ifdef TUPP_COROUTINES
+size_t tupp_internal::run_async_tests(const std::vector<std::pair<const std::string *, tupp::AsyncTestFunc>> & tests)
 {
-    print(message_type::HEADER, "START", true);
     size_t failed_count = 0u;
-    for (const auto & [test_name, test_func] : _all_tests)
+    size_t running_count = 0u;
+    std::vector<std::unique_ptr<async_test_state>> states;
+    states.reserve(tests.size());
+
+    const auto complete = [&](async_test_state & test)
     {
-        if (_tests_to_run.count(test_name) > 0u || _tests_to_run.empty())
+        test.finished = true;
+        --running_count;
+        if (!complete_async(test))
+            ++failed_count;
+    };
+
+    // Start all tests. Every test runs until its first suspension.
+    for (const auto & [name, func] : tests)
+    {
+        states.push_back(std::make_unique<async_test_state>());
+        async_test_state & test = *states.back();
+        test.name = *name;
+        test.context.name = *name;
+        ++running_count;
+
+        if (_events)
+            emit_event(event_builder("test_started").add("test", test.name));
+
+        test.start = test_clock::now();
+        swap_context(test.context);
+        try
         {
-            print(message_type::TEST_NAME, "TEST '" + test_name + "': ", false);
-            try
-            {
-                _case_params = std::nullopt;
-                test_func();
-            }
-            catch (const tupp_exception &)
-            {
-                // Nothing do.
-            }
-            catch (const std::exception & e)
+            test.task = func();
+        }
+        catch (const std::exception & e)
+        {
+            add_exception(e);
+        }
+        swap_context(test.context);
+
+        if (test.task.done())
+            complete(test);
+        else
+            resume_async(test, test.task.handle());
+
+        if (!test.finished && test.task.done())
+            complete(test);
+    }
+
+    // Event loop.
+    std::vector<async_waiter> ready;
+    while (running_count > 0u)
+    {
+        if (_async_timers.empty() && _async_fds.empty())
+        {
+            for (const auto & test : states)
             {
-                const std::string msg = "  Exception: " + std::string(e.what());
-                _case_messages.push_back(msg);
+                if (test->finished)
+                    continue;
+                swap_context(test->context);
+                add_text("Fail Async test is suspended without pending timers or descriptors");
                 _case_result = false;
+                swap_context(test->context);
+                complete(*test);
             }
+            break;
+        }
 
-            if (_case_result)
-            {
-                print(message_type::SUCCESS, "SUCCESS", true);
-            }
-            else
+        int timeout_ms = -1;
+        if (!_async_timers.empty())
+        {
+            const test_clock::duration wait = _async_timers.begin()->first - test_clock::now();
+            const auto wait_ms = std::chrono::ceil<std::chrono::milliseconds>(wait).count();
+            timeout_ms = wait_ms > 0 ? static_cast<int>(wait_ms) : 0;
+        }
+
+#ifdef TUPP_POSIX
+        std::vector<pollfd> poll_fds;
+        poll_fds.reserve(_async_fds.size());
+        for (const async_waiter & waiter : _async_fds)
+            poll_fds.push_back(pollfd{waiter.fd, static_cast<short>(waiter.write ? POLLOUT : POLLIN), 0});
+
+        const int poll_res = ::poll(poll_fds.data(), static_cast<nfds_t>(poll_fds.size()), timeout_ms);
+        if (poll_res > 0)
+        {
+            size_t pending = 0u;
+            for (size_t i = 0u; i < _async_fds.size(); ++i)
             {
-                print(message_type::FAIL, "FAIL", true);
-                ++failed_count;
+                if (poll_fds[i].revents != 0)
+                    ready.push_back(_async_fds[i]);
+                else
+                    _async_fds[pending++] = _async_fds[i];
             }
+            _async_fds.resize(pending);
+        }
+#else
+        if (timeout_ms > 0)
+            std::this_thread::sleep_for(std::chrono::milliseconds(timeout_ms));
+#endif
 
-            for (const std::string & msg : _case_messages)
-                print(message_type::TEST_MESSAGE, msg, true);
+        const test_clock::time_point now = test_clock::now();
+        while (!_async_timers.empty() && _async_timers.begin()->first <= now)
+        {
+            ready.push_back(_async_timers.begin()->second);
+            _async_timers.erase(_async_timers.begin());
+        }
 
-            _case_messages.clear();
-            _case_result = true;
+        for (const async_waiter & waiter : ready)
+        {
+            resume_async(*waiter.test, waiter.handle);
+            if (!waiter.test->finished && waiter.test->task.done())
+                complete(*waiter.test);
         }
+        ready.clear();
     }
 
-    print(message_type::HEADER, "FINISH", true);
-    const size_t tests_count = _tests_to_run.empty() ? _all_tests.size() : _tests_to_run.size();
-    std::string report_msg;
-    report_msg += "Run: " + std::to_string(tests_count) + "/" + std::to_string(_all_tests.size());
-    report_msg += ", Fail: " + std::to_string(failed_count);
-    report_msg += ", Pass: " + std::to_string(tests_count - failed_count);
-    print(message_type::REPORT, report_msg, true);
+    return failed_count;
+}
 
-    if (failed_count > 0u)
-        return handle_status(status(status::status_code::TESTS_FAIL));
-    else
-        return handle_status(status(status::status_code::SUCCESS));
+void tupp_internal::resume_async(async_test_state & test, std::coroutine_handle<> handle)
+{
+    swap_context(test.context);
+    _async_current = &test;
+    handle.resume();
+    _async_current = nullptr;
+    swap_context(test.context);
 }
 
+bool tupp_internal::complete_async(async_test_state & test)
+{
+    const test_clock::duration test_duration = test_clock::now() - test.start;
+
+    swap_context(test.context);
+    try
+    {
+        if (const std::exception_ptr e = test.task.exception())
+            std::rethrow_exception(e);
+    }
+    catch (const tupp_exception &)
+    {
+        // Nothing do.
+    }
+    catch (const std::exception & e)
+    {
+        add_exception(e);
+    }
+
+    print(message_type::TEST_NAME, "TEST '" + test.name + "': ", false);
+    return finish_test(test.name, test_duration, std::nullopt);
+}
+#endif
 
 tupp::tupp()
     : _internal(new tupp_internal())
@@ -590,47 +2835,398 @@ int tupp::run(int argc, char* argv[])
     return _internal->run(argc, argv);
 }
 
-void tupp::add_test(const TestFunc & test_func, const std::string & name)
+void tupp::add_test(const TestFunc & test_func, std::string_view name)
 {
     tupp_internal * _internal = internal();
-    _internal->add_test(test_func, name);
+    _internal->add_test(test_func, std::string(name));
 }
 
-void tupp::assert(bool v, const std::string & msg, const std::string & additional_msg, size_t line)
+#ifdef TUPP_COROUTINES
+void tupp::add_async_test(AsyncTestFunc test_func, std::string_view name)
 {
     tupp_internal * _internal = internal();
-    _internal->set_msg(msg);
-    if (!additional_msg.empty())
-        _internal->set_additional_msg(additional_msg);
-    _internal->set_line(line);
-    _internal->assert(v);
-    _internal->apply_case();
+    _internal->add_async_test(test_func, std::string(name));
+}
+
+tupp::AsyncWait tupp::sleep_for(unsigned long long ms)
+{
+    return AsyncWait(ms, -1, false);
+}
+
+tupp::AsyncWait tupp::wait_readable(int fd)
+{
+    return AsyncWait(0u, fd, false);
+}
+
+tupp::AsyncWait tupp::wait_writable(int fd)
+{
+    return AsyncWait(0u, fd, true);
 }
 
-void tupp::assert_tf(bool v, bool expected, const std::string & msg, const std::string & additional_msg, size_t line)
+void tupp::schedule(const AsyncWait & wait, void * handle)
 {
     tupp_internal * _internal = internal();
-    _internal->set_msg(msg);
-    if (!additional_msg.empty())
-        _internal->set_additional_msg(additional_msg);
+    _internal->schedule(wait._ms, wait._fd, wait._write, std::coroutine_handle<>::from_address(handle));
+}
+#endif
+
+void tupp::set_max_rss(std::string_view name, size_t max_rss_mb)
+{
+    tupp_internal * _internal = internal();
+    _internal->set_max_rss(std::string(name), max_rss_mb);
+}
+
+void tupp::set_tags(std::string_view name, MsgList tags)
+{
+    tupp_internal * _internal = internal();
+    _internal->set_tags(std::string(name), std::vector<std::string>(tags.begin(), tags.end()));
+}
+
+void tupp::set_hints(std::string_view name, unsigned long long expected_duration_ms, unsigned int threads)
+{
+    tupp_internal * _internal = internal();
+    _internal->set_hints(std::string(name), expected_duration_ms, threads);
+}
+
+/// @brief Common part of the assert methods. `static_msg` - `msg` is a string literal of a macro.
+static void apply_assert(tupp_internal * _internal, bool v, std::string_view msg, bool static_msg, size_t line,
+    tupp::MsgList additionals, std::string_view expected = std::string_view())
+{
+    _internal->set_msg(msg, static_msg);
+    _internal->set_additionals(additionals);
     _internal->set_line(line);
-    _internal->set_expected(expected ? "true" : "false");
-    _internal->assert(v == expected);
+    _internal->set_expected(expected);
+    _internal->assert(v);
     _internal->apply_case();
 }
 
-void tupp::assert_flt(float a, float b, const std::string & msg, const std::string & additional_msg, size_t line)
+void tupp::t_assert(bool v, std::string_view msg, size_t line, MsgList additionals)
+{
+    apply_assert(internal(), v, msg, false, line, additionals);
+}
+
+void tupp::t_assert(bool v, StaticText msg, size_t line, MsgList additionals)
+{
+    apply_assert(internal(), v, msg.text, true, line, additionals);
+}
+
+void tupp::t_assert_tf(bool v, bool expected, std::string_view msg, size_t line, MsgList additionals)
+{
+    apply_assert(internal(), v == expected, msg, false, line, additionals, expected ? "true" : "false");
+}
+
+void tupp::t_assert_tf(bool v, bool expected, StaticText msg, size_t line, MsgList additionals)
+{
+    apply_assert(internal(), v == expected, msg.text, true, line, additionals, expected ? "true" : "false");
+}
+
+void tupp::t_assert_flt(float a, float b, std::string_view msg, size_t line, MsgList additionals)
+{
+    t_assert(
+        std::fabs(a - b) <= FLOAT_CHECKING_ACCURACY,
+        msg, line, additionals
+    );
+}
+
+void tupp::t_assert_flt(float a, float b, StaticText msg, size_t line, MsgList additionals)
 {
-    assert(
+    t_assert(
         std::fabs(a - b) <= FLOAT_CHECKING_ACCURACY,
-        msg, additional_msg, line
+        msg, line, additionals
     );
 }
 
-void tupp::message(const std::string & msg, size_t line)
+void tupp::t_assert_snapshot(std::string_view name, std::string_view data, std::string_view msg, size_t line,
+    MsgList additionals)
+{
+    tupp_internal * _internal = internal();
+    _internal->assert_snapshot(name, data, std::string(), msg, false, line, additionals);
+}
+
+void tupp::t_assert_snapshot(std::string_view name, std::string_view data, StaticText msg, size_t line,
+    MsgList additionals)
+{
+    tupp_internal * _internal = internal();
+    _internal->assert_snapshot(name, data, std::string(), msg.text, true, line, additionals);
+}
+
+void tupp::t_assert_snapshot_file(std::string_view name, std::string_view path, std::string_view msg, size_t line,
+    MsgList additionals)
+{
+    tupp_internal * _internal = internal();
+    _internal->assert_snapshot(name, std::string_view(), std::string(path), msg, false, line, additionals);
+}
+
+void tupp::t_assert_snapshot_file(std::string_view name, std::string_view path, StaticText msg, size_t line,
+    MsgList additionals)
+{
+    tupp_internal * _internal = internal();
+    _internal->assert_snapshot(name, std::string_view(), std::string(path), msg.text, true, line, additionals);
+}
+
+/// @brief Make the percentile table of the histogram. The `checked` percentile is added to the
+///     standard percentiles.
+static std::string make_percentile_table(const tupp::Histogram & hist, double checked)
+{
+    std::vector<double> percentiles = {50.0, 75.0, 90.0, 95.0, 99.0, 99.9, 99.99, 99.999, 100.0};
+    if (std::find(percentiles.begin(), percentiles.end(), checked) == percentiles.end())
+        percentiles.insert(std::lower_bound(percentiles.begin(), percentiles.end(), checked), checked);
+
+    std::string table = "count: " + std::to_string(hist.count()) + ", min: " + std::to_string(hist.min())
+        + ", max: " + std::to_string(hist.max()) + "\n";
+    table += "percentile                value\n";
+    for (const double percentile : percentiles)
+    {
+        char row[64];
+        std::snprintf(row, sizeof(row), "%10.3f %20llu\n", percentile, hist.percentile(percentile));
+        table += row;
+    }
+    return table;
+}
+
+/// @brief Common part of the percentile assert methods.
+static void assert_percentile(tupp_internal * _internal, const tupp::Histogram & hist, double percentile,
+    unsigned long long max, std::string_view msg, bool static_msg, size_t line, tupp::MsgList additionals)
+{
+    std::string additional_msg;
+    bool v = false;
+    if (hist.count() == 0u)
+    {
+        additional_msg = "histogram is empty";
+    }
+    else
+    {
+        const unsigned long long value = hist.percentile(percentile);
+        v = value <= max;
+        additional_msg = "measured " + std::to_string(value) + " (count: " + std::to_string(hist.count()) + ")";
+    }
+
+    const std::string user_msg = join_additionals(additionals);
+    if (!user_msg.empty())
+        additional_msg += " " + user_msg;
+    if (!v && hist.count() > 0u)
+    {
+        additional_msg += "\n" + make_percentile_table(hist, percentile);
+        additional_msg.pop_back(); // The last line break.
+    }
+    _internal->report_perf(v, msg, {additional_msg}, line, static_msg);
+}
+
+void tupp::t_assert_percentile(const Histogram & hist, double percentile, unsigned long long max,
+    std::string_view msg, size_t line, MsgList additionals)
+{
+    assert_percentile(internal(), hist, percentile, max, msg, false, line, additionals);
+}
+
+void tupp::t_assert_percentile(const Histogram & hist, double percentile, unsigned long long max,
+    StaticText msg, size_t line, MsgList additionals)
+{
+    assert_percentile(internal(), hist, percentile, max, msg.text, true, line, additionals);
+}
+
+void tupp::message(std::string_view msg, size_t line)
 {
     tupp_internal * _internal = internal();
     _internal->set_msg(msg);
     _internal->set_line(line);
     _internal->apply_case();
 }
+
+struct tupp::PerfScope::state
+{
+    PerfCounter counter;
+    unsigned long long budget;
+    std::string msg;
+    std::string additional_msg;
+    size_t line;
+
+    unsigned int repetitions = PERF_REPETITIONS;
+    bool available = true;
+    bool running = false;
+    std::vector<unsigned long long> samples;
+
+    std::chrono::steady_clock::time_point start_time;
+    int counter_fd = -1;
+
+    bool open_counter();
+    void start();
+    unsigned long long stop();
+    const char * unit() const;
+};
+
+bool tupp::PerfScope::state::open_counter()
+{
+#ifdef TUPP_PERF_EVENT
+    perf_event_attr attr;
+    std::memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    switch (counter)
+    {
+    case PerfCounter::INSTRUCTIONS: attr.config = PERF_COUNT_HW_INSTRUCTIONS; break;
+    case PerfCounter::CYCLES: attr.config = PERF_COUNT_HW_CPU_CYCLES; break;
+    case PerfCounter::CACHE_MISSES: attr.config = PERF_COUNT_HW_CACHE_MISSES; break;
+    case PerfCounter::TIME_NS:
+    default:
+        return false;
+    }
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+
+    counter_fd = static_cast<int>(::syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+    return counter_fd >= 0;
+#else
+    return false;
+#endif
+}
+
+void tupp::PerfScope::state::start()
+{
+    running = true;
+#ifdef TUPP_PERF_EVENT
+    if (counter_fd >= 0)
+    {
+        ::ioctl(counter_fd, PERF_EVENT_IOC_RESET, 0);
+        ::ioctl(counter_fd, PERF_EVENT_IOC_ENABLE, 0);
+        return;
+    }
+#endif
+    start_time = std::chrono::steady_clock::now();
+}
+
+unsigned long long tupp::PerfScope::state::stop()
+{
+    running = false;
+#ifdef TUPP_PERF_EVENT
+    if (counter_fd >= 0)
+    {
+        ::ioctl(counter_fd, PERF_EVENT_IOC_DISABLE, 0);
+        std::uint64_t value = 0u;
+        if (::read(counter_fd, &value, sizeof(value)) != static_cast<ssize_t>(sizeof(value)))
+            return 0u;
+        return value;
+    }
+#endif
+    const auto duration = std::chrono::steady_clock::now() - start_time;
+    return static_cast<unsigned long long>(std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count());
+}
+
+const char * tupp::PerfScope::state::unit() const
+{
+    switch (counter)
+    {
+    case PerfCounter::TIME_NS: return "ns";
+    case PerfCounter::INSTRUCTIONS: return "instructions";
+    case PerfCounter::CYCLES: return "cycles";
+    case PerfCounter::CACHE_MISSES: return "cache misses";
+    default: return "";
+    }
+}
+
+tupp::PerfScope::PerfScope(PerfCounter counter, unsigned long long budget, std::string_view msg, size_t line,
+    MsgList additionals)
+    : _state(new state())
+{
+    _state->counter = counter;
+    _state->budget = budget;
+    _state->msg = std::string(msg);
+    _state->additional_msg = join_additionals(additionals);
+    _state->line = line;
+
+    if (counter != PerfCounter::TIME_NS && !_state->open_counter())
+    {
+        _state->available = false;
+        _state->repetitions = 1u;
+    }
+}
+
+tupp::PerfScope::~PerfScope()
+{
+#ifdef TUPP_PERF_EVENT
+    if (_state->counter_fd >= 0)
+        ::close(_state->counter_fd);
+#endif
+    delete _state;
+}
+
+bool tupp::PerfScope::next()
+{
+    state & st = *_state;
+    if (st.running)
+        st.samples.push_back(st.stop());
+
+    if (st.samples.size() < st.repetitions)
+    {
+        st.start();
+        return true;
+    }
+
+    std::string additional_msg;
+    if (!st.available)
+    {
+        additional_msg = "skipped: hardware counters are unavailable";
+        if (!st.additional_msg.empty())
+            additional_msg += " " + st.additional_msg;
+        internal()->report_perf(std::nullopt, st.msg, {additional_msg}, st.line);
+        return false;
+    }
+
+    std::sort(st.samples.begin(), st.samples.end());
+    const unsigned long long median = st.samples[st.samples.size() / 2u];
+
+    additional_msg = "measured " + std::to_string(median) + " " + st.unit()
+        + " (median of " + std::to_string(st.samples.size()) + ")";
+    if (!st.additional_msg.empty())
+        additional_msg += " " + st.additional_msg;
+    internal()->report_perf(median <= st.budget, st.msg, {additional_msg}, st.line);
+    return false;
+}
+
+/// @brief The highest value which is counted by the bucket `index` of the histogram.
+static unsigned long long histogram_bucket_highest(size_t index)
+{
+    if (index < 2u * tupp::Histogram::SUB_BUCKETS)
+        return index;
+    const size_t shift = index / tupp::Histogram::SUB_BUCKETS - 1u;
+    const unsigned long long sub_bucket = index - shift * tupp::Histogram::SUB_BUCKETS;
+    // Wraps to the maximum value for the last bucket.
+    return ((sub_bucket + 1u) << shift) - 1u;
+}
+
+void tupp::Histogram::merge(const Histogram & other) noexcept
+{
+    for (size_t i = 0u; i < BUCKETS; ++i)
+        _counts[i] += other._counts[i];
+    _count += other._count;
+    _min = std::min(_min, other._min);
+    _max = std::max(_max, other._max);
+}
+
+void tupp::Histogram::reset() noexcept
+{
+    std::fill(std::begin(_counts), std::end(_counts), 0u);
+    _count = 0u;
+    _min = ~0ull;
+    _max = 0u;
+}
+
+unsigned long long tupp::Histogram::percentile(double percent) const noexcept
+{
+    if (_count == 0u)
+        return 0u;
+    if (percent <= 0.0)
+        return _min;
+
+    const double rank = std::ceil(std::min(percent, 100.0) / 100.0 * static_cast<double>(_count));
+    const unsigned long long target = std::clamp(static_cast<unsigned long long>(rank), 1ull, _count);
+
+    unsigned long long counted = 0u;
+    for (size_t i = 0u; i < BUCKETS; ++i)
+    {
+        counted += _counts[i];
+        if (counted >= target)
+            return std::min(histogram_bucket_highest(i), _max);
+    }
+    return _max;
+}
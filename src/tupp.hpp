@@ -11,36 +11,39 @@
 #ifndef _TUPP_HPP_
 #define _TUPP_HPP_
 
-#include <string>
-#include <functional>
+#include <cstddef>
+#include <initializer_list>
+#include <string_view>
+#include <type_traits>
+#include <utility>
 
 /// @brief Macro for checking the equality of two variables.
 #ifdef TUPP_ASSERT
 #undef TUPP_ASSERT
 #endif
 #define TUPP_ASSERT(V_A, V_B, ...)                                                  \
-    tupp::t_assert(V_A == V_B, #V_A  " == "  #V_B, __LINE__, ##__VA_ARGS__)
+    tupp::t_assert(V_A == V_B, tupp::StaticText{#V_A  " == "  #V_B}, __LINE__, {__VA_ARGS__})
 
 /// @brief Macro for checking the inequality of two variables.
 #ifdef TUPP_N_ASSERT
 #undef TUPP_N_ASSERT
 #endif
 #define TUPP_N_ASSERT(V_A, V_B, ...)                                                \
-    tupp::t_assert(V_A != V_B, #V_A  " != "  #V_B, __LINE__, ##__VA_ARGS__)
+    tupp::t_assert(V_A != V_B, tupp::StaticText{#V_A  " != "  #V_B}, __LINE__, {__VA_ARGS__})
 
 /// @brief Macro for check that a variable is true.
 #ifdef TUPP_ASSERT_TRUE
 #undef TUPP_ASSERT_TRUE
 #endif
 #define TUPP_ASSERT_TRUE(V, ...)                                                    \
-    tupp::t_assert_tf(V, true, #V, __LINE__, ##__VA_ARGS__)
+    tupp::t_assert_tf(V, true, tupp::StaticText{#V}, __LINE__, {__VA_ARGS__})
 
 /// @brief Macro for check that a variable is false.
 #ifdef TUPP_ASSERT_FALSE
 #undef TUPP_ASSERT_FALSE
 #endif
 #define TUPP_ASSERT_FALSE(V, ...)                                                   \
-    tupp::t_assert_tf(V, false, #V, __LINE__, ##__VA_ARGS__)
+    tupp::t_assert_tf(V, false, tupp::StaticText{#V}, __LINE__, {__VA_ARGS__})
 
 /// @brief Macro for print a some message.
 #ifdef TUPP_MESSAGE
@@ -56,7 +59,83 @@
 #undef TUPP_ASSERT_F
 #endif
 #define TUPP_ASSERT_F(V_A, V_B, ...)                                                \
-    tupp::t_assert_flt(V_A, V_B, #V_A " == " #V_B, __LINE__, ##__VA_ARGS__)
+    tupp::t_assert_flt(V_A, V_B, tupp::StaticText{#V_A " == " #V_B}, __LINE__, {__VA_ARGS__})
+
+/// @brief Macro for checking data with the golden file (snapshot) `NAME`.
+///
+/// The golden file is placed in the snapshots directory. It can be created or updated by the
+/// `--update-snapshots` command line key.
+#ifdef TUPP_ASSERT_SNAPSHOT
+#undef TUPP_ASSERT_SNAPSHOT
+#endif
+#define TUPP_ASSERT_SNAPSHOT(NAME, DATA, ...)                                       \
+    tupp::t_assert_snapshot(NAME, DATA, tupp::StaticText{"snapshot " #NAME}, __LINE__, {__VA_ARGS__})
+
+/// @brief Macro for checking the file `PATH` with the golden file (snapshot) `NAME`.
+///
+/// The same as `TUPP_ASSERT_SNAPSHOT` but data are read from the file.
+#ifdef TUPP_ASSERT_SNAPSHOT_FILE
+#undef TUPP_ASSERT_SNAPSHOT_FILE
+#endif
+#define TUPP_ASSERT_SNAPSHOT_FILE(NAME, PATH, ...)                                  \
+    tupp::t_assert_snapshot_file(NAME, PATH, tupp::StaticText{"snapshot " #NAME}, __LINE__, {__VA_ARGS__})
+
+/// @brief Macro for checking that the `PERCENTILE` (0-100) of values of `tupp::Histogram` `HIST`
+///     is no more than `MAX`.
+///
+/// The percentile table of the histogram is displayed on failure.
+#ifdef TUPP_ASSERT_PERCENTILE
+#undef TUPP_ASSERT_PERCENTILE
+#endif
+#define TUPP_ASSERT_PERCENTILE(HIST, PERCENTILE, MAX, ...)                          \
+    tupp::t_assert_percentile(HIST, PERCENTILE, MAX,                                \
+        tupp::StaticText{"percentile " #PERCENTILE " of " #HIST " <= " #MAX}, __LINE__, {__VA_ARGS__})
+
+/// @brief Macro for checking that the following block takes no more than `BUDGET` nanoseconds.
+///
+/// The block is executed `tupp::PERF_REPETITIONS` times and the median time is checked.
+#ifdef TUPP_ASSERT_MAX_NS
+#undef TUPP_ASSERT_MAX_NS
+#endif
+#define TUPP_ASSERT_MAX_NS(BUDGET, ...)                                             \
+    TUPP_PERF_SCOPE(TIME_NS, BUDGET, "time <= " #BUDGET " ns", ##__VA_ARGS__)
+
+/// @brief Macro for checking that the following block executes no more than `BUDGET` instructions.
+///
+/// It uses hardware counters (Linux `perf_event`). If counters are unavailable the block is
+/// executed once and the check is skipped with a message.
+#ifdef TUPP_ASSERT_MAX_INSTRUCTIONS
+#undef TUPP_ASSERT_MAX_INSTRUCTIONS
+#endif
+#define TUPP_ASSERT_MAX_INSTRUCTIONS(BUDGET, ...)                                   \
+    TUPP_PERF_SCOPE(INSTRUCTIONS, BUDGET, "instructions <= " #BUDGET, ##__VA_ARGS__)
+
+/// @brief Macro for checking that the following block takes no more than `BUDGET` CPU cycles.
+///
+/// The same as `TUPP_ASSERT_MAX_INSTRUCTIONS` but for CPU cycles.
+#ifdef TUPP_ASSERT_MAX_CYCLES
+#undef TUPP_ASSERT_MAX_CYCLES
+#endif
+#define TUPP_ASSERT_MAX_CYCLES(BUDGET, ...)                                         \
+    TUPP_PERF_SCOPE(CYCLES, BUDGET, "cycles <= " #BUDGET, ##__VA_ARGS__)
+
+/// @brief Macro for checking that the following block makes no more than `BUDGET` cache misses.
+///
+/// The same as `TUPP_ASSERT_MAX_INSTRUCTIONS` but for cache misses.
+#ifdef TUPP_ASSERT_MAX_CACHE_MISSES
+#undef TUPP_ASSERT_MAX_CACHE_MISSES
+#endif
+#define TUPP_ASSERT_MAX_CACHE_MISSES(BUDGET, ...)                                   \
+    TUPP_PERF_SCOPE(CACHE_MISSES, BUDGET, "cache misses <= " #BUDGET, ##__VA_ARGS__)
+
+/// @brief Helper macro for performance assertion macros.
+#ifdef TUPP_PERF_SCOPE
+#undef TUPP_PERF_SCOPE
+#endif
+#define TUPP_PERF_SCOPE(COUNTER, BUDGET, MSG, ...)                                  \
+    for (tupp::PerfScope tupp_perf_scope(tupp::PerfCounter::COUNTER, BUDGET, MSG,  \
+            __LINE__, {__VA_ARGS__});                                               \
+        tupp_perf_scope.next();)
 
 /// @brief Macro for test addition.
 /// @param TEST_NAME - This is a test function name. It is also will be used as test name.
@@ -66,6 +145,27 @@
 #define TUPP_ADD_TEST(TEST_NAME)                                                    \
     tupp::add_test(&TEST_NAME, #TEST_NAME)
 
+/// @brief Macro for definition of the entry point of a test module.
+///
+/// A test module is a shared library with tests which is loaded by the `--module` command line
+/// key of any test program. The entry point registers tests of the module:
+/// @code
+/// TUPP_MODULE()
+/// {
+///     TUPP_ADD_TEST(test_function);
+/// }
+/// @endcode
+#ifdef TUPP_MODULE
+#undef TUPP_MODULE
+#endif
+#ifdef _WIN32
+#define TUPP_MODULE()                                                               \
+    extern "C" __declspec(dllexport) void tupp_module_register()
+#else
+#define TUPP_MODULE()                                                               \
+    extern "C" __attribute__((visibility("default"))) void tupp_module_register()
+#endif
+
 class tupp_internal;
 
 /// @brief Main class with functional for make unit tests.
@@ -80,7 +180,207 @@ public:
     tupp & operator=(tupp &) = delete;
     tupp & operator=(tupp &&) = delete;
 
-    using TestFunc = std::function<void()>;
+    /// @brief Test function holder. Signature of the test function: `void ()`.
+    ///
+    /// It is a small replacement of `std::function<void()>` which allows to don't include
+    /// `<functional>` to every test translation unit. Any callable object can be implicitly
+    /// converted to it.
+    class TestFunc
+    {
+    public:
+
+        TestFunc() = default;
+
+        TestFunc(void (*func)())
+            : _func(func)
+        {
+        }
+
+        template <typename TFunc, typename = std::enable_if_t<!std::is_same_v<std::decay_t<TFunc>, TestFunc>>>
+        TestFunc(TFunc && func)
+            : _obj(new std::decay_t<TFunc>(std::forward<TFunc>(func)))
+            , _invoke(&invoke_obj<std::decay_t<TFunc>>)
+            , _clone(&clone_obj<std::decay_t<TFunc>>)
+            , _destroy(&destroy_obj<std::decay_t<TFunc>>)
+        {
+        }
+
+        TestFunc(const TestFunc & other)
+            : _func(other._func)
+            , _obj(other._obj ? other._clone(other._obj) : nullptr)
+            , _invoke(other._invoke)
+            , _clone(other._clone)
+            , _destroy(other._destroy)
+        {
+        }
+
+        TestFunc(TestFunc && other) noexcept
+        {
+            swap(other);
+        }
+
+        TestFunc & operator=(TestFunc other) noexcept
+        {
+            swap(other);
+            return *this;
+        }
+
+        ~TestFunc()
+        {
+            if (_obj)
+                _destroy(_obj);
+        }
+
+        void operator()() const
+        {
+            if (_func)
+                _func();
+            else
+                _invoke(_obj);
+        }
+
+        explicit operator bool() const { return _func != nullptr || _obj != nullptr; }
+
+    private:
+
+        void swap(TestFunc & other) noexcept
+        {
+            std::swap(_func, other._func);
+            std::swap(_obj, other._obj);
+            std::swap(_invoke, other._invoke);
+            std::swap(_clone, other._clone);
+            std::swap(_destroy, other._destroy);
+        }
+
+        template <typename TFunc>
+        static void invoke_obj(void * obj) { (*static_cast<TFunc *>(obj))(); }
+        template <typename TFunc>
+        static void * clone_obj(const void * obj) { return new TFunc(*static_cast<const TFunc *>(obj)); }
+        template <typename TFunc>
+        static void destroy_obj(void * obj) { delete static_cast<TFunc *>(obj); }
+
+        // A plain function is stored without allocation.
+        void (*_func)() = nullptr;
+        void * _obj = nullptr;
+        void (*_invoke)(void *) = nullptr;
+        void * (*_clone)(const void *) = nullptr;
+        void (*_destroy)(void *) = nullptr;
+    };
+
+    using MsgList = std::initializer_list<std::string_view>;
+
+    /// @brief Text with static storage duration (a string literal). Assert macros pass checked
+    ///     code strings by this type, so the strings are stored without copying.
+    struct StaticText
+    {
+        std::string_view text;
+    };
+
+    /// @brief Value measured by performance assertions.
+    enum class PerfCounter
+    {
+        TIME_NS,
+        INSTRUCTIONS,
+        CYCLES,
+        CACHE_MISSES,
+    };
+
+    /// @brief Count of the measured block executions in performance assertions.
+    static constexpr unsigned int PERF_REPETITIONS = 5u;
+
+    /// @brief Scope of a performance assertion. Used by performance assertion macros.
+    ///
+    /// `next()` finishes the current measurement and starts the next one. When all measurements
+    /// are done it compares the median of measured values with the budget, reports the result as
+    /// an assert and returns `false`.
+    class PerfScope
+    {
+    public:
+
+        PerfScope(PerfCounter counter, unsigned long long budget, std::string_view msg, size_t line,
+            MsgList additionals);
+        PerfScope(const PerfScope &) = delete;
+        PerfScope & operator=(const PerfScope &) = delete;
+        ~PerfScope();
+
+        bool next();
+
+    private:
+
+        struct state;
+        state * _state;
+    };
+
+    /// @brief Histogram of values (for example latencies in nanoseconds) for percentile assertions.
+    ///
+    /// Values are counted in a log-bucketed layout like HDR histogram: values less than
+    /// `2 * SUB_BUCKETS` are counted exactly, every next power of two range is split into
+    /// `SUB_BUCKETS` buckets. So the relative error of a value is less than `1 / SUB_BUCKETS` and
+    /// all range of `unsigned long long` is covered by the fixed count of buckets. Recording
+    /// doesn't allocate memory.
+    ///
+    /// The histogram isn't thread safe: use a histogram per thread and merge them.
+    class Histogram
+    {
+    public:
+
+        static constexpr unsigned int SUB_BUCKET_BITS = 7u;
+        static constexpr unsigned long long SUB_BUCKETS = 1ull << SUB_BUCKET_BITS;
+        static constexpr size_t BUCKETS = (64u - SUB_BUCKET_BITS + 1u) * SUB_BUCKETS;
+
+        /// @brief Record the value.
+        void record(unsigned long long value) noexcept
+        {
+            ++_counts[index(value)];
+            ++_count;
+            if (value < _min)
+                _min = value;
+            if (value > _max)
+                _max = value;
+        }
+
+        /// @brief Add all values of `other` histogram to this histogram.
+        void merge(const Histogram & other) noexcept;
+        /// @brief Remove all values.
+        void reset() noexcept;
+
+        /// @brief Value which is no less than `percent` (0-100) percents of recorded values.
+        ///
+        /// The result is the highest value of the found bucket (but no more than `max()`). It is 0
+        /// if the histogram is empty.
+        unsigned long long percentile(double percent) const noexcept;
+
+        unsigned long long count() const noexcept { return _count; }
+        unsigned long long min() const noexcept { return _count > 0u ? _min : 0u; }
+        unsigned long long max() const noexcept { return _max; }
+
+    private:
+
+        static size_t index(unsigned long long value) noexcept
+        {
+            if (value < SUB_BUCKETS)
+                return static_cast<size_t>(value);
+            const unsigned int shift = highest_bit(value) - SUB_BUCKET_BITS;
+            return static_cast<size_t>(shift * SUB_BUCKETS + (value >> shift));
+        }
+
+        static unsigned int highest_bit(unsigned long long value) noexcept
+        {
+#if defined(__GNUC__) || defined(__clang__)
+            return 63u - static_cast<unsigned int>(__builtin_clzll(value));
+#else
+            unsigned int bit = 0u;
+            while (value >>= 1u)
+                ++bit;
+            return bit;
+#endif
+        }
+
+        unsigned long long _counts[BUCKETS] = {};
+        unsigned long long _count = 0u;
+        unsigned long long _min = ~0ull;
+        unsigned long long _max = 0u;
+    };
 
     /// @brief Method for run tests.
     /// @param argc - count of command line arguments.
@@ -90,7 +390,9 @@ public:
     ///     1 - one or more tests are fails,
     ///     100 - bad command line arguments,
     ///     101 - error "invalid key",
-    ///     102 - error "invalid key usage".
+    ///     102 - error "invalid key usage",
+    ///     103 - error "test module loading",
+    ///     104 - error "output file writing".
     static int run(int argc, char* argv[]);
 
     /// @brief Method for show message.
@@ -98,14 +400,61 @@ public:
     /// @param line - code line number.
     ///
     /// This method is used by `TUPP_MESSAGE` macro.
-    static void message(const std::string & msg, size_t line);
+    static void message(std::string_view msg, size_t line);
 
     /// @brief Method for test addition.
     /// @param test_func - pointer of test function. Signature of this function: @see TestFunc.
     /// @param name - test name.
     ///
     /// This method is used by `TUPP_ADD_TEST` macro.
-    static void add_test(const TestFunc & test_func, const std::string & name);
+    static void add_test(const TestFunc & test_func, std::string_view name);
+
+    /// @brief Method for set a resident memory limit of the test.
+    /// @param name - test name.
+    /// @param max_rss_mb - maximum resident memory of the process during the test in megabytes.
+    ///
+    /// The limit overrides the value of the `--max-rss` command line key for this test.
+    static void set_max_rss(std::string_view name, size_t max_rss_mb);
+
+    /// @brief Method for set tags of the test. Tags are written to the tests manifest.
+    /// @param name - test name.
+    /// @param tags - list of tags.
+    static void set_tags(std::string_view name, MsgList tags);
+
+    /// @brief Method for set resource hints of the test for external schedulers. Hints are
+    ///     written to the tests manifest.
+    /// @param name - test name.
+    /// @param expected_duration_ms - expected duration of the test in milliseconds (0 - unknown).
+    /// @param threads - count of threads needed by the test (0 - unknown).
+    static void set_hints(std::string_view name, unsigned long long expected_duration_ms, unsigned int threads);
+
+    /// @brief Result type of an async test coroutine (C++20 only, defined in `tupp_async.hpp`).
+    class AsyncTask;
+
+    /// @brief Signature of an async test coroutine.
+    using AsyncTestFunc = AsyncTask (*)();
+
+    /// @brief Awaitable of the event loop: timer or file descriptor readiness (defined in
+    ///     `tupp_async.hpp`).
+    class AsyncWait;
+
+    /// @brief Method for async test addition (C++20 only).
+    /// @param test_func - pointer of test coroutine. Signature of this coroutine: @see AsyncTestFunc.
+    /// @param name - test name.
+    ///
+    /// Async tests are executed after other tests by the single-threaded event loop. All of them
+    /// are started together and interleaved on their suspension points. This method is used by
+    /// `TUPP_ADD_ASYNC_TEST` macro.
+    static void add_async_test(AsyncTestFunc test_func, std::string_view name);
+
+    /// @brief Suspend the async test for `ms` milliseconds. Usage: `co_await tupp::sleep_for(10);`.
+    static AsyncWait sleep_for(unsigned long long ms);
+
+    /// @brief Suspend the async test until the file descriptor `fd` is readable (POSIX only).
+    static AsyncWait wait_readable(int fd);
+
+    /// @brief Suspend the async test until the file descriptor `fd` is writable (POSIX only).
+    static AsyncWait wait_writable(int fd);
 
     /// @brief Method for check that `v` is not false. Used for assertion macros.
     /// @param v - result of a test passing. Assertion is activated if this paramenter is `false`.
@@ -116,11 +465,7 @@ public:
     ///     messages.
     ///
     /// This method is used by `TUPP_ASSERT` and `TUPP_N_ASSERT` macros.
-    template <typename... TMsg>
-    static void t_assert(bool v, const std::string & msg, size_t line, const TMsg & ... additionals)
-    {
-        assert(v, msg, make_additional(additionals...), line);
-    }
+    static void t_assert(bool v, std::string_view msg, size_t line, MsgList additionals);
 
     /// @brief Method for check that `v` is equal `expected`. Used for boolean assertion macros.
     /// @param v - passed tested boolean value.
@@ -133,11 +478,7 @@ public:
     ///
     /// Assertion is activated if `v` is not equal `expected`. This method is used by
     /// `TUPP_ASSERT_TRUE` and `TUPP_ASSERT_FALSE` macros.
-    template <typename... TMsg>
-    static void t_assert_tf(bool v, bool expected, const std::string & msg, size_t line, const TMsg & ... additionals)
-    {
-        assert_tf(v, expected, msg, make_additional(additionals...), line);
-    }
+    static void t_assert_tf(bool v, bool expected, std::string_view msg, size_t line, MsgList additionals);
 
     /// @brief Method for check equality of two float variables. Used for float assertion macros.
     /// @param a - first tested variable.
@@ -149,27 +490,82 @@ public:
     ///     messages.
     ///
     /// Assertion is activated if `a` is different from `b` by `FLOAT_CHECKING_ACCURACY`.
+    static void t_assert_flt(float a, float b, std::string_view msg, size_t line, MsgList additionals);
+
+    /// @brief Method for check data with the golden file. Used for snapshot assertion macros.
+    /// @param name - name of the golden file in the snapshots directory.
+    /// @param data - checked data.
+    /// @param msg displayed message. This message field used for auto generating and displayed
+    ///     checked code string.
+    /// @param line - code line number.
+    /// @param additionals - additionals displayed message parts. This parameters for user defined
+    ///     messages.
+    ///
+    /// Assertion is activated if `data` is different from the golden file content or the golden
+    /// file doesn't exist. In the `--update-snapshots` mode the golden file is rewritten by `data`.
+    /// This method is used by `TUPP_ASSERT_SNAPSHOT` macro.
+    static void t_assert_snapshot(std::string_view name, std::string_view data, std::string_view msg, size_t line,
+        MsgList additionals);
+
+    /// @brief Method for check the file with the golden file. Used for snapshot assertion macros.
+    ///
+    /// The same as `t_assert_snapshot` but data are read from the file `path`. This method is
+    /// used by `TUPP_ASSERT_SNAPSHOT_FILE` macro.
+    static void t_assert_snapshot_file(std::string_view name, std::string_view path, std::string_view msg, size_t line,
+        MsgList additionals);
+
+    /// @brief Method for check a percentile of the histogram. Used for percentile assertion macro.
+    /// @param hist - histogram of checked values.
+    /// @param percentile - checked percentile (0-100).
+    /// @param max - maximum allowed value of the percentile.
+    /// @param msg displayed message. This message field used for auto generating and displayed
+    ///     checked code string.
+    /// @param line - code line number.
+    /// @param additionals - additionals displayed message parts. This parameters for user defined
+    ///     messages.
+    ///
+    /// Assertion is activated if the percentile value is greater than `max` or the histogram is
+    /// empty. The percentile table of the histogram is displayed in this case. This method is used
+    /// by `TUPP_ASSERT_PERCENTILE` macro.
+    static void t_assert_percentile(const Histogram & hist, double percentile, unsigned long long max,
+        std::string_view msg, size_t line, MsgList additionals);
+
+    /// @brief Overloads of the assert methods for the macros: `msg` is a string literal.
+    static void t_assert(bool v, StaticText msg, size_t line, MsgList additionals);
+    static void t_assert_tf(bool v, bool expected, StaticText msg, size_t line, MsgList additionals);
+    static void t_assert_flt(float a, float b, StaticText msg, size_t line, MsgList additionals);
+    static void t_assert_snapshot(std::string_view name, std::string_view data, StaticText msg, size_t line,
+        MsgList additionals);
+    static void t_assert_snapshot_file(std::string_view name, std::string_view path, StaticText msg, size_t line,
+        MsgList additionals);
+    static void t_assert_percentile(const Histogram & hist, double percentile, unsigned long long max,
+        StaticText msg, size_t line, MsgList additionals);
+
+    /// @brief Variadic form of `t_assert` for a direct usage.
     template <typename... TMsg>
-    static void t_assert_flt(float a, float b, const std::string & msg, size_t line, const TMsg & ... additionals)
+    static void t_assert(bool v, std::string_view msg, size_t line, const TMsg & ... additionals)
     {
-        assert_flt(a, b, msg, make_additional(additionals...), line);
+        t_assert(v, msg, line, {std::string_view(additionals)...});
     }
 
-private:
-
-    static void assert(bool v, const std::string & msg, const std::string & additional_msg, size_t line);
-    static void assert_tf(bool v, bool expected, const std::string & msg, const std::string & additional_msg, size_t line);
-    static void assert_flt(float a, float b, const std::string & msg, const std::string & additional_msg, size_t line);
+    /// @brief Variadic form of `t_assert_tf` for a direct usage.
+    template <typename... TMsg>
+    static void t_assert_tf(bool v, bool expected, std::string_view msg, size_t line, const TMsg & ... additionals)
+    {
+        t_assert_tf(v, expected, msg, line, {std::string_view(additionals)...});
+    }
 
+    /// @brief Variadic form of `t_assert_flt` for a direct usage.
     template <typename... TMsg>
-    static std::string make_additional(const TMsg & ... additionals)
+    static void t_assert_flt(float a, float b, std::string_view msg, size_t line, const TMsg & ... additionals)
     {
-        if constexpr (sizeof... (additionals) > 0u)
-            return (... + std::string(additionals));
-        else
-            return {};
+        t_assert_flt(a, b, msg, line, {std::string_view(additionals)...});
     }
 
+private:
+
+    static void schedule(const AsyncWait & wait, void * handle);
+
     static tupp_internal * internal();
     static tupp & instance();
 
@@ -0,0 +1,144 @@
+/**************************************************************************************************
+ * @file
+ * @author Konovalov Aleksander
+ * @copyright This file is part of library TinyUnit++ and has the same license. @see LICENSE.txt
+ * @brief It is include file of async tests.
+ * 
+ * This file contains coroutine types of async tests (C++20 only). It is included only by files
+ * with async tests, so other files don't pay for `<coroutine>`.
+ *************************************************************************************************/
+
+#ifndef _TUPP_ASYNC_HPP_
+#define _TUPP_ASYNC_HPP_
+
+#include "tupp.hpp"
+
+#if defined(__cpp_impl_coroutine) && __cpp_impl_coroutine >= 201902L && __has_include(<coroutine>)
+#define TUPP_COROUTINES
+#include <coroutine>
+#include <exception>
+
+/// @brief Macro for async test addition (C++20 only).
+/// @param TEST_NAME - This is a test coroutine name. It is also will be used as test name.
+#ifdef TUPP_ADD_ASYNC_TEST
+#undef TUPP_ADD_ASYNC_TEST
+#endif
+#define TUPP_ADD_ASYNC_TEST(TEST_NAME)                                              \
+    tupp::add_async_test(&TEST_NAME, #TEST_NAME)
+
+/// @brief Result type of an async test coroutine.
+///
+/// The coroutine is started lazily by the event loop. An async test can `co_await` other
+/// coroutines with this type, `tupp::sleep_for`, `tupp::wait_readable` and `tupp::wait_writable`.
+class tupp::AsyncTask
+{
+public:
+
+    struct promise_type
+    {
+        std::exception_ptr exception;
+        std::coroutine_handle<> continuation;
+
+        AsyncTask get_return_object()
+        {
+            return AsyncTask(std::coroutine_handle<promise_type>::from_promise(*this));
+        }
+
+        std::suspend_always initial_suspend() noexcept { return {}; }
+
+        auto final_suspend() noexcept
+        {
+            struct final_awaiter
+            {
+                bool await_ready() noexcept { return false; }
+                std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> handle) noexcept
+                {
+                    const std::coroutine_handle<> continuation = handle.promise().continuation;
+                    return continuation ? continuation : std::noop_coroutine();
+                }
+                void await_resume() noexcept {}
+            };
+            return final_awaiter();
+        }
+
+        void return_void() {}
+        void unhandled_exception() { exception = std::current_exception(); }
+    };
+
+    AsyncTask() = default;
+    AsyncTask(const AsyncTask &) = delete;
+    AsyncTask & operator=(const AsyncTask &) = delete;
+
+    AsyncTask(AsyncTask && other) noexcept
+        : _handle(std::exchange(other._handle, nullptr))
+    {
+    }
+
+    AsyncTask & operator=(AsyncTask && other) noexcept
+    {
+        std::swap(_handle, other._handle);
+        return *this;
+    }
+
+    ~AsyncTask()
+    {
+        if (_handle)
+            _handle.destroy();
+    }
+
+    std::coroutine_handle<> handle() const { return _handle; }
+    bool done() const { return !_handle || _handle.done(); }
+    std::exception_ptr exception() const { return _handle ? _handle.promise().exception : nullptr; }
+
+    bool await_ready() const noexcept { return done(); }
+
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> handle) noexcept
+    {
+        _handle.promise().continuation = handle;
+        return _handle;
+    }
+
+    void await_resume() const
+    {
+        if (const std::exception_ptr e = exception())
+            std::rethrow_exception(e);
+    }
+
+private:
+
+    explicit AsyncTask(std::coroutine_handle<promise_type> handle)
+        : _handle(handle)
+    {
+    }
+
+    std::coroutine_handle<promise_type> _handle;
+};
+
+/// @brief Awaitable of the event loop: timer or file descriptor readiness.
+class tupp::AsyncWait
+{
+public:
+
+    bool await_ready() const noexcept { return false; }
+    void await_suspend(std::coroutine_handle<> handle) const { schedule(*this, handle.address()); }
+    void await_resume() const noexcept {}
+
+private:
+
+    friend class tupp;
+
+    AsyncWait(unsigned long long ms, int fd, bool write)
+        : _ms(ms)
+        , _fd(fd)
+        , _write(write)
+    {
+    }
+
+    unsigned long long _ms;
+    int _fd;
+    bool _write;
+};
+
+#endif
+
+#endif // _TUPP_ASYNC_HPP_
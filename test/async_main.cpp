@@ -0,0 +1,59 @@
+#include "tupp_async.hpp"
+
+#include <string>
+#include <sys/socket.h>
+#include <unistd.h>
+
+tupp::AsyncTask delayed_value(int & value, int v)
+{
+    co_await tupp::sleep_for(20);
+    value = v;
+}
+
+tupp::AsyncTask test_async_sleep()
+{
+    TUPP_MESSAGE("before sleep");
+    co_await tupp::sleep_for(50);
+    TUPP_MESSAGE("after sleep");
+
+    int value = 0;
+    co_await delayed_value(value, 5);
+    TUPP_ASSERT(value, 5);
+}
+
+tupp::AsyncTask test_async_fails()
+{
+    co_await tupp::sleep_for(10);
+    TUPP_ASSERT(1, 2, "failed while other tests are suspended");
+}
+
+tupp::AsyncTask test_async_socket()
+{
+    int fds[2];
+    TUPP_ASSERT(::socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+
+    co_await tupp::wait_writable(fds[0]);
+    TUPP_ASSERT(::write(fds[0], "ping", 4), 4);
+
+    co_await tupp::wait_readable(fds[1]);
+    char buf[4];
+    TUPP_ASSERT(::read(fds[1], buf, sizeof(buf)), 4);
+    TUPP_ASSERT(std::string(buf, 4), "ping");
+
+    ::close(fds[0]);
+    ::close(fds[1]);
+}
+
+void test_sync()
+{
+    TUPP_ASSERT_TRUE(true);
+}
+
+int main(int argc, char* argv[])
+{
+    TUPP_ADD_TEST(test_sync);
+    TUPP_ADD_ASYNC_TEST(test_async_sleep);
+    TUPP_ADD_ASYNC_TEST(test_async_fails);
+    TUPP_ADD_ASYNC_TEST(test_async_socket);
+    return tupp::run(argc, argv);
+}
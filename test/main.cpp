@@ -1,5 +1,9 @@
 #include "tupp.hpp"
 
+#include <string>
+#include <thread>
+#include <vector>
+
 void test_fails()
 {
     TUPP_MESSAGE("abcde");
@@ -51,10 +55,82 @@ void test_fails_2()
     TUPP_ASSERT(a, b);
 }
 
+void test_additional_messages()
+{
+    int a = 5;
+    int b = 8;
+    TUPP_ASSERT(a, b, "Additional ", std::string("message"));
+}
+
+void test_perf()
+{
+    volatile int sum = 0;
+    TUPP_ASSERT_MAX_NS(1000000000)
+    {
+        for (int i = 0; i < 1000; ++i)
+            sum = sum + i;
+    }
+
+    TUPP_ASSERT_MAX_INSTRUCTIONS(10, "loop budget")
+    {
+        for (int i = 0; i < 1000; ++i)
+            sum = sum + i;
+    }
+
+    TUPP_ASSERT_MAX_NS(1)
+    {
+        for (int i = 0; i < 1000; ++i)
+            sum = sum + i;
+    }
+}
+
+void test_percentile()
+{
+    tupp::Histogram latencies[2];
+    std::thread worker([&latencies]()
+    {
+        for (unsigned long long i = 0u; i < 100000u; ++i)
+            latencies[1].record(1000u + i % 100u);
+    });
+    for (unsigned long long i = 0u; i < 100000u; ++i)
+        latencies[0].record(i % 50u == 0u ? 250000u : 1000u + i % 100u);
+    worker.join();
+
+    latencies[0].merge(latencies[1]);
+    TUPP_ASSERT_PERCENTILE(latencies[0], 50.0, 2000u);
+    TUPP_ASSERT_PERCENTILE(latencies[0], 99.5, 200000u, "SLO");
+}
+
+void test_memory()
+{
+    std::vector<char> data(64u * 1024u * 1024u, 1);
+    TUPP_ASSERT_TRUE(data.back() == 1);
+}
+
+void test_snapshot()
+{
+    std::string report;
+    for (int i = 0; i < 100; ++i)
+        report += "line " + std::to_string(i) + "\n";
+    TUPP_ASSERT_SNAPSHOT("report.txt", report);
+
+    report.replace(report.find("line 50"), 7, "line fifty");
+    TUPP_ASSERT_SNAPSHOT("report.txt", report, "changed report");
+}
+
 int main(int argc, char* argv[])
 {
     TUPP_ADD_TEST(test_fails);
     TUPP_ADD_TEST(test_success);
     TUPP_ADD_TEST(test_fails_2);
+    TUPP_ADD_TEST(test_additional_messages);
+    TUPP_ADD_TEST(test_perf);
+    TUPP_ADD_TEST(test_percentile);
+    TUPP_ADD_TEST(test_memory);
+    TUPP_ADD_TEST(test_snapshot);
+    tupp::set_max_rss("test_memory", 32u);
+    tupp::set_tags("test_memory", {"memory", "slow"});
+    tupp::set_hints("test_perf", 10u, 1u);
+    tupp::add_test([]() { tupp::t_assert(true, "lambda", __LINE__, "direct ", "call"); }, "test_lambda");
     return tupp::run(argc, argv);
 }
@@ -0,0 +1,21 @@
+#include "tupp.hpp"
+
+void test_module_success()
+{
+    TUPP_MESSAGE("from module");
+    TUPP_ASSERT(2 + 2, 4);
+}
+
+void test_module_fails()
+{
+    int a = 5;
+    int b = 8;
+    TUPP_ASSERT(a, b, "module assert");
+}
+
+TUPP_MODULE()
+{
+    TUPP_ADD_TEST(test_module_success);
+    TUPP_ADD_TEST(test_module_fails);
+    tupp::set_tags("test_module_fails", {"module"});
+}